@@ -20,7 +20,7 @@ static std::vector<std::string> get_services(const std::string &whitelist_str, b
 }
 
 void msgq_to_zmq(const std::vector<std::string> &endpoints, const std::string &ip) {
-  MsgqToZmq bridge;
+  MsgqToZmq bridge(util::getenv("BRIDGE_THREADS", 2));
   bridge.run(endpoints, ip);
 }
 
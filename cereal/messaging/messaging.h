@@ -1,17 +1,34 @@
 #pragma once
 
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
 
 #include <capnp/serialize.h>
 
 #include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/stats.h"
 #include "common/timing.h"
 #include "msgq/ipc.h"
 
+// How SubMaster::update handles a socket that has more than one message queued.
+enum class DrainPolicy {
+  NEXT,    // receive one message per update, the rest stays queued (default)
+  LATEST,  // drain the socket and keep only the newest message
+  ALL,     // drain the socket and hand every message to a callback, the newest is kept
+};
+using DrainCallback = std::function<void(const char *name, cereal::Event::Reader event)>;
+
 class SubMaster {
 public:
   SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll = {},
@@ -25,6 +42,7 @@ public:
   ~SubMaster();
 
   uint64_t frame = 0;
+  uint64_t bytes_copied = 0;  // payload bytes memcpy'd because the received data was unaligned
   bool updated(const char *name) const;
   bool alive(const char *name) const;
   bool valid(const char *name) const;
@@ -32,17 +50,47 @@ public:
   uint64_t rcv_time(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
+  void setDrainPolicy(const char *name, DrainPolicy policy, DrainCallback callback = nullptr);
+  // messages discarded by DrainPolicy::LATEST
+  uint64_t dropped(const char *name) const;
+  // updates that found more than one message queued
+  uint64_t conflated(const char *name) const;
+
+  // opt-in latency, jitter, size and drop statistics, also enabled by MESSAGING_STATS=1
+  void enableStats();
+  std::string dumpStats() const;
+
+  // O(1) lookups keyed by the event union discriminant, e.g. sm.updated(cereal::Event::CAR_STATE)
+  bool updated(cereal::Event::Which which) const;
+  bool alive(cereal::Event::Which which) const;
+  bool valid(cereal::Event::Which which) const;
+  uint64_t rcv_frame(cereal::Event::Which which) const;
+  uint64_t rcv_time(cereal::Event::Which which) const;
+  cereal::Event::Reader &operator[](cereal::Event::Which which) const;
+
 private:
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
   Poller *poller_ = nullptr;
   struct SubMessage;
+  SubMessage *at(cereal::Event::Which which) const;
   std::map<SubSocket *, SubMessage *> messages_;
   std::map<std::string, SubMessage *> services_;
+  std::vector<SubMessage *> events_;  // indexed by cereal::Event::Which
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // builds into a caller-owned first segment, which must be zeroed
+  explicit MessageBuilder(kj::ArrayPtr<capnp::word> first_segment) : capnp::MallocMessageBuilder(first_segment) {}
+
+  // counts the segments handed out by the builder. external data, like from
+  // referenceExternalData(), is added as a segment without being allocated.
+  kj::ArrayPtr<capnp::word> allocateSegment(unsigned int minimum_size) override {
+    ++allocated_segments;
+    return capnp::MallocMessageBuilder::allocateSegment(minimum_size);
+  }
+  unsigned int allocated_segments = 0;
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -68,21 +116,93 @@ public:
     return serialized_size;
   }
 
+  // serializes into buf, growing it only when the message doesn't fit
+  kj::ArrayPtr<capnp::byte> toBytes(std::vector<capnp::byte> &buf) {
+    size_t serialized_size = getSerializedSize();
+    if (buf.size() < serialized_size) {
+      buf.resize(serialized_size);
+    }
+    kj::ArrayOutputStream out(kj::ArrayPtr<capnp::byte>(buf.data(), serialized_size));
+    capnp::writeMessage(out, *this);
+    return out.getArray();
+  }
+
 private:
   kj::Array<capnp::word> heapArray_;
 };
 
+// Recycles the first segment across messages, so building a message that fits
+// in it doesn't touch the heap. Call reset() before building each message.
+class ReusableMessageBuilder {
+public:
+  explicit ReusableMessageBuilder(size_t first_segment_words = 1024)
+      : segment_(kj::heapArray<capnp::word>(first_segment_words)) {
+    memset(segment_.begin(), 0, segment_.asBytes().size());
+  }
+
+  MessageBuilder &reset() {
+    if (builder_) {
+      auto segments = builder_->getSegmentsForOutput();
+      if (builder_->allocated_segments > 1) ++allocations;
+      size_t used = segments.size() > 0 ? segments[0].size() : 0;
+      builder_.reset();
+      memset(segment_.begin(), 0, used * sizeof(capnp::word));
+    }
+    return builder_.emplace(segment_);
+  }
+
+  // number of messages that outgrew the first segment
+  uint64_t allocations = 0;
+
+private:
+  kj::Array<capnp::word> segment_;
+  std::optional<MessageBuilder> builder_;
+};
+
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
-  int send(const char *name, MessageBuilder &msg);
+  inline int send(const char *name, capnp::byte *data, size_t size) { return send(at(name), data, size); }
+  // serializes into a per-socket buffer that is reused across messages
+  inline int send(const char *name, MessageBuilder &msg) { return send(at(name), msg); }
+  // O(1) lookups keyed by the event union discriminant
+  inline int send(cereal::Event::Which which, capnp::byte *data, size_t size) { return send(at(which), data, size); }
+  inline int send(cereal::Event::Which which, MessageBuilder &msg) { return send(at(which), msg); }
   ~PubMaster();
 
+  // number of times a per-socket send buffer had to grow
+  uint64_t allocations = 0;
+
+  // opt-in send time, interval jitter, size and failure statistics, also enabled by MESSAGING_STATS=1
+  void enableStats();
+  std::string dumpStats() const;
+
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  struct PubSocketBuffer {
+    PubSocket *socket = nullptr;
+    float freq = 0.0f;
+    std::vector<capnp::byte> buf;
+    std::unique_ptr<ServiceStats> stats;
+  };
+  int send(PubSocketBuffer *s, capnp::byte *data, size_t size);
+  int send(PubSocketBuffer *s, MessageBuilder &msg);
+  inline PubSocketBuffer *at(cereal::Event::Which which) const {
+    assert(which < events_.size() && events_[which] != nullptr);
+    return events_[which];
+  }
+  // like sockets_.at(name), without building a std::string
+  inline PubSocketBuffer *at(const char *name) {
+    auto it = sockets_.find(std::string_view(name));
+    if (it == sockets_.end()) throw std::out_of_range(name);
+    return &it->second;
+  }
+  std::map<std::string, PubSocketBuffer, std::less<>> sockets_;
+  std::vector<PubSocketBuffer *> events_;  // indexed by cereal::Event::Which
 };
 
+// Maps a service name to its cereal::Event union discriminant.
+cereal::Event::Which event_which(const char *name);
+
 class AlignedBuffer {
 public:
   kj::ArrayPtr<const capnp::word> align(const char *data, const size_t size) {
@@ -96,6 +216,16 @@ public:
   inline kj::ArrayPtr<const capnp::word> align(Message *m) {
     return align(m->getData(), m->getSize());
   }
+  // Points straight into the message if it is word-aligned, otherwise falls back to a copy.
+  // The returned array is only valid as long as `m` is alive.
+  inline kj::ArrayPtr<const capnp::word> view(Message *m, bool *copied = nullptr) {
+    const char *data = m->getData();
+    const size_t size = m->getSize();
+    bool aligned = (reinterpret_cast<uintptr_t>(data) % alignof(capnp::word)) == 0 && (size % sizeof(capnp::word)) == 0;
+    if (copied) *copied = !aligned;
+    if (!aligned) return align(data, size);
+    return kj::ArrayPtr<const capnp::word>(reinterpret_cast<const capnp::word *>(data), size / sizeof(capnp::word));
+  }
 private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
@@ -1,6 +1,7 @@
 #include "cereal/messaging/msgq_to_zmq.h"
 
 #include <cassert>
+#include <thread>
 
 #include "common/util.h"
 
@@ -20,61 +21,125 @@ static std::string recv_zmq_msg(void *sock) {
   return ret;
 }
 
+// Hands the msgq buffer over to zmq instead of copying it. msg is deleted once zmq is done with it.
+static int send_zmq_msg(ZMQPubSocket *pub_sock, Message *msg) {
+  zmq_msg_t zmsg;
+  zmq_msg_init_data(&zmsg, msg->getData(), msg->getSize(), [](void *, void *hint) { delete (Message *)hint; }, msg);
+  int ret;
+  while ((ret = zmq_msg_send(&zmsg, pub_sock->sock, ZMQ_DONTWAIT)) == -1) {
+    if (errno != EINTR) {
+      zmq_msg_close(&zmsg);
+      break;
+    }
+  }
+  return ret;
+}
+
 void MsgqToZmq::run(const std::vector<std::string> &endpoints, const std::string &ip) {
   zmq_context = std::make_unique<ZMQContext>();
   msgq_context = std::make_unique<MSGQContext>();
 
-  // Create ZMQPubSockets for each endpoint
+  for (int i = 0; i < std::min<int>(num_threads, endpoints.size()); ++i) {
+    workers.emplace_back(std::make_unique<Worker>());
+  }
+
+  // Create ZMQPubSockets for each endpoint, round-robin across workers
   for (const auto &endpoint : endpoints) {
-    auto &socket_pair = socket_pairs.emplace_back();
-    socket_pair.endpoint = endpoint;
-    socket_pair.pub_sock = std::make_unique<ZMQPubSocket>();
-    int ret = socket_pair.pub_sock->connect(zmq_context.get(), endpoint);
+    auto &socket_pair = socket_pairs.emplace_back(std::make_unique<SocketPair>());
+    socket_pair->endpoint = endpoint;
+    socket_pair->pub_sock = std::make_unique<ZMQPubSocket>();
+    int ret = socket_pair->pub_sock->connect(zmq_context.get(), endpoint);
     if (ret != 0) {
       printf("Failed to create ZMQ publisher for [%s]: %s\n", endpoint.c_str(), zmq_strerror(zmq_errno()));
       return;
     }
+
+    Worker *worker = workers[(socket_pairs.size() - 1) % workers.size()].get();
+    worker->pairs.push_back(socket_pair.get());
+    pair_workers.push_back(worker);
+  }
+
+  // zmq sockets aren't thread safe, so the monitors are set up on the pub sockets
+  // before the workers start sending on them and torn down after they are joined
+  for (int i = 0; i < socket_pairs.size(); ++i) {
+    std::string addr = "inproc://op-bridge-monitor-" + std::to_string(i);
+    zmq_socket_monitor(socket_pairs[i]->pub_sock->sock, addr.c_str(), ZMQ_EVENT_ACCEPTED | ZMQ_EVENT_DISCONNECTED);
+
+    void *monitor_socket = zmq_socket(zmq_context->getRawContext(), ZMQ_PAIR);
+    zmq_connect(monitor_socket, addr.c_str());
+    monitor_sockets.push_back(monitor_socket);
   }
 
   // Start ZMQ monitoring thread to monitor socket events
-  std::thread thread(&MsgqToZmq::zmqMonitorThread, this);
+  std::thread monitor_thread(&MsgqToZmq::zmqMonitorThread, this);
+
+  std::vector<std::thread> worker_threads;
+  for (auto &worker : workers) {
+    worker_threads.emplace_back(&MsgqToZmq::workerThread, this, worker.get());
+  }
+
+  for (auto &t : worker_threads) t.join();
+  monitor_thread.join();
+
+  // Clean up monitor sockets
+  for (int i = 0; i < monitor_sockets.size(); ++i) {
+    zmq_socket_monitor(socket_pairs[i]->pub_sock->sock, nullptr, 0);
+    zmq_close(monitor_sockets[i]);
+  }
+  monitor_sockets.clear();
+}
+
+void MsgqToZmq::workerThread(Worker *worker) {
+  uint64_t generation = worker->generation.load(std::memory_order_acquire);
+  registerSockets(worker);
 
-  // Main loop for processing messages
   while (!do_exit) {
-    {
-      std::unique_lock lk(mutex);
-      cv.wait(lk, [this]() { return do_exit || !sub2pub.empty(); });
-      if (do_exit) break;
-
-      for (auto sub_sock : msgq_poller->poll(100)) {
-        // Process messages for each socket
-        ZMQPubSocket *pub_sock = sub2pub.at(sub_sock);
-        for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
-          auto msg = std::unique_ptr<Message>(sub_sock->receive(true));
-          if (!msg) break;
-
-          while (pub_sock->sendMessage(msg.get()) == -1) {
-            if (errno != EINTR) break;
-          }
-        }
+    // pick up subscriber changes published by the monitor thread
+    if (uint64_t gen = worker->generation.load(std::memory_order_acquire); gen != generation) {
+      generation = gen;
+      registerSockets(worker);
+    }
+
+    if (worker->sub2pub.empty()) {
+      util::sleep_for(10);  // nobody is listening
+      continue;
+    }
+
+    for (auto sub_sock : worker->poller->poll(100)) {
+      // Process messages for each socket
+      ZMQPubSocket *pub_sock = worker->sub2pub.at(sub_sock);
+      for (int i = 0; i < MAX_MESSAGES_PER_SOCKET; ++i) {
+        Message *msg = sub_sock->receive(true);
+        if (!msg) break;
+        send_zmq_msg(pub_sock, msg);
       }
     }
-    util::sleep_for(1);  // Give zmqMonitorThread a chance to acquire the mutex
   }
+}
 
-  thread.join();
+void MsgqToZmq::registerSockets(Worker *worker) {
+  worker->sub2pub.clear();
+  worker->poller = std::make_unique<MSGQPoller>();
+  for (auto pair : worker->pairs) {
+    bool subscribed = pair->connected_clients.load(std::memory_order_relaxed) > 0;
+    if (subscribed && !pair->sub_sock) {
+      // Create new MSGQ subscriber socket and map to ZMQ publisher
+      pair->sub_sock = std::make_unique<MSGQSubSocket>();
+      pair->sub_sock->connect(msgq_context.get(), pair->endpoint, "127.0.0.1");
+    } else if (!subscribed && pair->sub_sock) {
+      pair->sub_sock.reset(nullptr);
+    }
+
+    if (pair->sub_sock) {
+      worker->sub2pub[pair->sub_sock.get()] = pair->pub_sock.get();
+      worker->poller->registerSocket(pair->sub_sock.get());
+    }
+  }
 }
 
 void MsgqToZmq::zmqMonitorThread() {
   std::vector<zmq_pollitem_t> pollitems;
-
-  // Set up ZMQ monitor for each pub socket
-  for (int i = 0; i < socket_pairs.size(); ++i) {
-    std::string addr = "inproc://op-bridge-monitor-" + std::to_string(i);
-    zmq_socket_monitor(socket_pairs[i].pub_sock->sock, addr.c_str(), ZMQ_EVENT_ACCEPTED | ZMQ_EVENT_DISCONNECTED);
-
-    void *monitor_socket = zmq_socket(zmq_context->getRawContext(), ZMQ_PAIR);
-    zmq_connect(monitor_socket, addr.c_str());
+  for (void *monitor_socket : monitor_sockets) {
     pollitems.emplace_back(zmq_pollitem_t{.socket = monitor_socket, .events = ZMQ_POLLIN});
   }
 
@@ -101,44 +166,18 @@ void MsgqToZmq::zmqMonitorThread() {
         frame = recv_zmq_msg(pollitems[i].socket);
         if (frame.empty()) continue;
 
-        std::unique_lock lk(mutex);
-        auto &pair = socket_pairs[i];
+        auto &pair = *socket_pairs[i];
+        int clients = pair.connected_clients.load(std::memory_order_relaxed);
         if (event_type & ZMQ_EVENT_ACCEPTED) {
           printf("socket [%s] connected\n", pair.endpoint.c_str());
-          if (++pair.connected_clients == 1) {
-            // Create new MSGQ subscriber socket and map to ZMQ publisher
-            pair.sub_sock = std::make_unique<MSGQSubSocket>();
-            pair.sub_sock->connect(msgq_context.get(), pair.endpoint, "127.0.0.1");
-            sub2pub[pair.sub_sock.get()] = pair.pub_sock.get();
-            registerSockets();
-          }
+          pair.connected_clients.store(clients + 1, std::memory_order_relaxed);
         } else if (event_type & ZMQ_EVENT_DISCONNECTED) {
           printf("socket [%s] disconnected\n", pair.endpoint.c_str());
-          if (pair.connected_clients == 0 || --pair.connected_clients == 0) {
-            // Remove MSGQ subscriber socket from mapping and reset it
-            sub2pub.erase(pair.sub_sock.get());
-            pair.sub_sock.reset(nullptr);
-            registerSockets();
-          }
+          pair.connected_clients.store(std::max(clients - 1, 0), std::memory_order_relaxed);
         }
-        cv.notify_one();
+        // the worker re-registers its sockets on the next loop iteration
+        pair_workers[i]->generation.fetch_add(1, std::memory_order_release);
       }
     }
   }
-
-  // Clean up monitor sockets
-  for (int i = 0; i < pollitems.size(); ++i) {
-    zmq_socket_monitor(socket_pairs[i].pub_sock->sock, nullptr, 0);
-    zmq_close(pollitems[i].socket);
-  }
-  cv.notify_one();
-}
-
-void MsgqToZmq::registerSockets() {
-  msgq_poller = std::make_unique<MSGQPoller>();
-  for (const auto &socket_pair : socket_pairs) {
-    if (socket_pair.sub_sock) {
-      msgq_poller->registerSocket(socket_pair.sub_sock.get());
-    }
-  }
 }
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <condition_variable>
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <vector>
 
@@ -13,25 +13,35 @@
 
 class MsgqToZmq {
 public:
-  MsgqToZmq() {}
+  // endpoints are sharded across num_threads forwarding threads
+  explicit MsgqToZmq(int num_threads = 1) : num_threads(std::max(num_threads, 1)) {}
   void run(const std::vector<std::string> &endpoints, const std::string &ip);
 
 protected:
-  void registerSockets();
-  void zmqMonitorThread();
-
   struct SocketPair {
     std::string endpoint;
     std::unique_ptr<ZMQPubSocket> pub_sock;
-    std::unique_ptr<MSGQSubSocket> sub_sock;
-    int connected_clients = 0;
+    std::unique_ptr<MSGQSubSocket> sub_sock;  // only touched by the owning worker
+    std::atomic<int> connected_clients = 0;   // only written by the monitor thread
+  };
+
+  struct Worker {
+    std::vector<SocketPair *> pairs;
+    // bumped by the monitor thread whenever connected_clients of one of the pairs changes
+    std::atomic<uint64_t> generation = 0;
+    std::unique_ptr<MSGQPoller> poller;
+    std::map<SubSocket *, ZMQPubSocket *> sub2pub;
   };
 
+  void workerThread(Worker *worker);
+  void registerSockets(Worker *worker);
+  void zmqMonitorThread();
+
+  const int num_threads;
   std::unique_ptr<MSGQContext> msgq_context;
   std::unique_ptr<ZMQContext> zmq_context;
-  std::mutex mutex;
-  std::condition_variable cv;
-  std::unique_ptr<MSGQPoller> msgq_poller;
-  std::map<SubSocket *, ZMQPubSocket *> sub2pub;
-  std::vector<SocketPair> socket_pairs;
+  std::vector<std::unique_ptr<SocketPair>> socket_pairs;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<Worker *> pair_workers;  // socket_pairs[i] is forwarded by pair_workers[i]
+  std::vector<void *> monitor_sockets;  // monitors socket_pairs[i], polled by the monitor thread
 };
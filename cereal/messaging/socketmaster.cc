@@ -3,10 +3,14 @@
 #include <string>
 #include <mutex>
 
+#include <capnp/schema.h>
+
 #include "cereal/services.h"
 #include "cereal/messaging/messaging.h"
+#include "third_party/json11/json11.hpp"
 
 const bool SIMULATION = (getenv("SIMULATION") != nullptr) && (std::string(getenv("SIMULATION")) == "1");
+const bool MESSAGING_STATS = (getenv("MESSAGING_STATS") != nullptr) && (std::string(getenv("MESSAGING_STATS")) == "1");
 
 static inline bool inList(const std::vector<const char *> &list, const char *value) {
   for (auto &v : list) {
@@ -30,6 +34,41 @@ private:
 
 MessageContext message_context;
 
+static inline size_t num_events() {
+  return capnp::Schema::from<cereal::Event>().getUnionFields().size();
+}
+
+cereal::Event::Which event_which(const char *name) {
+  auto field = capnp::Schema::from<cereal::Event>().getFieldByName(name);
+  uint16_t discriminant = field.getProto().getDiscriminantValue();
+  assert(discriminant != capnp::schema::Field::NO_DISCRIMINANT);
+  return static_cast<cereal::Event::Which>(discriminant);
+}
+
+static inline capnp::ReaderOptions reader_options() {
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue; // Don't limit
+  return options;
+}
+
+static inline void record_stats(ServiceStats *stats, cereal::Event::Reader event, size_t size, uint64_t now) {
+  uint64_t mono_time = event.getLogMonoTime();
+  stats->record(now, mono_time, now > mono_time ? now - mono_time : 0, size);
+}
+
+static json11::Json stats_json(const ServiceStats &stats, const char *latency_key) {
+  return json11::Json::object{
+    {"count", (double)stats.latency_us.count()},
+    {"rate", stats.rate()},
+    {"expected_rate", stats.frequency},
+    {"gaps", (double)stats.gaps.load()},
+    {"send_failures", (double)stats.send_failures.load()},
+    {latency_key, histogram_json(stats.latency_us)},
+    {"jitter_us", histogram_json(stats.jitter_us)},
+    {"size_bytes", histogram_json(stats.size_bytes)},
+  };
+}
+
 struct SubMaster::SubMessage {
   std::string name;
   SubSocket *socket = nullptr;
@@ -39,13 +78,18 @@ struct SubMaster::SubMessage {
   void *allocated_msg_reader = nullptr;
   bool is_polled = false;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
+  Message *msg = nullptr;  // kept alive while msg_reader points into it
   AlignedBuffer aligned_buf;
+  DrainPolicy policy = DrainPolicy::NEXT;
+  DrainCallback callback;
+  uint64_t dropped = 0, conflated = 0;
   cereal::Event::Reader event;
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll,
                      const char *address, const std::vector<const char *> &ignore_alive) {
   poller_ = Poller::create();
+  events_.resize(num_events(), nullptr);
   for (auto name : service_list) {
     assert(services.count(std::string(name)) > 0);
 
@@ -64,7 +108,9 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
     messages_[socket] = m;
     services_[name] = m;
+    events_[event_which(name)] = m;
   }
+  if (MESSAGING_STATS) enableStats();
 }
 
 void SubMaster::update(int timeout) {
@@ -89,12 +135,45 @@ void SubMaster::update(int timeout) {
 
     SubMessage *m = messages_.at(s);
 
+    if (m->policy != DrainPolicy::NEXT) {
+      // drain the socket, keeping only the newest message
+      uint64_t received = 1;
+      while (Message *next = s->receive(true)) {
+        if (m->policy == DrainPolicy::ALL || m->stats) {
+          AlignedBuffer buf;
+          capnp::FlatArrayMessageReader reader(buf.view(msg), reader_options());
+          auto event = reader.getRoot<cereal::Event>();
+          if (m->stats) record_stats(m->stats.get(), event, msg->getSize(), current_time);
+          if (m->policy == DrainPolicy::ALL) m->callback(m->name.c_str(), event);
+        }
+        if (m->policy == DrainPolicy::LATEST) ++m->dropped;
+        delete msg;
+        msg = next;
+        ++received;
+      }
+      if (received > 1) ++m->conflated;
+    }
+
     m->msg_reader->~FlatArrayMessageReader();
-    capnp::ReaderOptions options;
-    options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    delete m->msg;
+    m->msg = nullptr;
+
+    // read in place if the payload is already word-aligned, copy only as a fallback
+    bool copied = false;
+    size_t size = msg->getSize();
+    auto words = m->aligned_buf.view(msg, &copied);
+    if (copied) {
+      bytes_copied += size;
+      delete msg;
+    } else {
+      m->msg = msg;
+    }
+
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(words, reader_options());
+    auto event = m->msg_reader->getRoot<cereal::Event>();
+    if (m->stats) record_stats(m->stats.get(), event, size, current_time);
+    if (m->policy == DrainPolicy::ALL) m->callback(m->name.c_str(), event);
+    messages.push_back({m->name, event});
   }
 
   update_msgs(current_time, messages);
@@ -173,31 +252,124 @@ cereal::Event::Reader &SubMaster::operator[](const char *name) const {
   return services_.at(name)->event;
 }
 
+void SubMaster::setDrainPolicy(const char *name, DrainPolicy policy, DrainCallback callback) {
+  assert(policy != DrainPolicy::ALL || callback);
+  SubMessage *m = services_.at(name);
+  m->policy = policy;
+  m->callback = callback;
+}
+
+uint64_t SubMaster::dropped(const char *name) const {
+  return services_.at(name)->dropped;
+}
+
+uint64_t SubMaster::conflated(const char *name) const {
+  return services_.at(name)->conflated;
+}
+
+void SubMaster::enableStats() {
+  for (auto &[_, m] : messages_) {
+    if (!m->stats) m->stats = std::make_unique<ServiceStats>(m->freq);
+  }
+}
+
+std::string SubMaster::dumpStats() const {
+  json11::Json::object ret;
+  for (auto &[name, m] : services_) {
+    if (m->stats) ret[name] = stats_json(*m->stats, "latency_us");
+  }
+  return json11::Json(ret).dump();
+}
+
+SubMaster::SubMessage *SubMaster::at(cereal::Event::Which which) const {
+  assert(which < events_.size() && events_[which] != nullptr);
+  return events_[which];
+}
+
+bool SubMaster::updated(cereal::Event::Which which) const {
+  return at(which)->updated;
+}
+
+bool SubMaster::alive(cereal::Event::Which which) const {
+  return at(which)->alive;
+}
+
+bool SubMaster::valid(cereal::Event::Which which) const {
+  return at(which)->valid;
+}
+
+uint64_t SubMaster::rcv_frame(cereal::Event::Which which) const {
+  return at(which)->rcv_frame;
+}
+
+uint64_t SubMaster::rcv_time(cereal::Event::Which which) const {
+  return at(which)->rcv_time;
+}
+
+cereal::Event::Reader &SubMaster::operator[](cereal::Event::Which which) const {
+  return at(which)->event;
+}
+
 SubMaster::~SubMaster() {
   delete poller_;
   for (auto &kv : messages_) {
     SubMessage *m = kv.second;
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
+    delete m->msg;
     delete m->socket;
     delete m;
   }
 }
 
 PubMaster::PubMaster(const std::vector<const char *> &service_list) {
+  events_.resize(num_events(), nullptr);
   for (auto name : service_list) {
     assert(services.count(name) > 0);
     PubSocket *socket = PubSocket::create(message_context.context(), name);
     assert(socket);
-    sockets_[name] = socket;
+    sockets_[name].socket = socket;
+    sockets_[name].freq = services.at(name).frequency;
+    events_[event_which(name)] = &sockets_[name];
+  }
+  if (MESSAGING_STATS) enableStats();
+}
+
+int PubMaster::send(PubSocketBuffer *s, capnp::byte *data, size_t size) {
+  if (!s->stats) return s->socket->send((char *)data, size);
+
+  uint64_t start = nanos_since_boot();
+  int ret = s->socket->send((char *)data, size);
+  uint64_t end = nanos_since_boot();
+  if (ret < 0) {
+    s->stats->send_failures.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    s->stats->record(end, start, end - start, size);
   }
+  return ret;
 }
 
-int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+int PubMaster::send(PubSocketBuffer *s, MessageBuilder &msg) {
+  size_t capacity = s->buf.capacity();
+  auto bytes = msg.toBytes(s->buf);
+  if (s->buf.capacity() != capacity) ++allocations;
+  return send(s, bytes.begin(), bytes.size());
+}
+
+void PubMaster::enableStats() {
+  for (auto &[_, s] : sockets_) {
+    if (!s.stats) s.stats = std::make_unique<ServiceStats>(s.freq);
+  }
+}
+
+std::string PubMaster::dumpStats() const {
+  json11::Json::object ret;
+  for (auto &[name, s] : sockets_) {
+    if (s.stats) ret[name] = stats_json(*s.stats, "send_us");
+  }
+  return json11::Json(ret).dump();
 }
 
 PubMaster::~PubMaster() {
-  for (auto s : sockets_) delete s.second;
+  for (auto &s : sockets_) delete s.second.socket;
 }
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "common/histogram.h"
+
+// Per-service message statistics, recorded by the thread that owns the
+// SubMaster/PubMaster and readable from any thread.
+struct ServiceStats {
+  explicit ServiceStats(float frequency) : frequency(frequency) {}
+
+  // mono_time is when the message was published (logMonoTime), latency_ns how long it took to arrive
+  void record(uint64_t now, uint64_t mono_time, uint64_t latency_ns, size_t size) {
+    uint64_t prev = last_mono_time.exchange(mono_time, std::memory_order_relaxed);
+    if (prev != 0 && mono_time > prev && frequency > 0) {
+      // compare the publish interval against the expected period to find jitter and gaps.
+      // services that publish on change or irregularly have gaps without losing messages
+      const double period = 1e9 / frequency;
+      const double interval = mono_time - prev;
+      jitter_us.add(std::abs(interval - period) / 1e3);
+      if (interval > 1.5 * period) {
+        gaps.fetch_add(std::llround(interval / period) - 1, std::memory_order_relaxed);
+      }
+    }
+    uint64_t expected = 0;
+    first_time.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+    last_time.store(now, std::memory_order_relaxed);
+    latency_us.add(latency_ns / 1000);
+    size_bytes.add(size);
+  }
+
+  // measured message rate in Hz
+  double rate() const {
+    uint64_t n = latency_us.count();
+    uint64_t first = first_time.load(std::memory_order_relaxed), last = last_time.load(std::memory_order_relaxed);
+    return (n > 1 && last > first) ? (n - 1) * 1e9 / (last - first) : 0;
+  }
+
+  const float frequency;  // expected rate from services.py
+  Histogram latency_us;
+  Histogram jitter_us;
+  Histogram size_bytes;
+  std::atomic<uint64_t> gaps = 0;           // missed periods in the publish timestamps
+  std::atomic<uint64_t> send_failures = 0;  // sends that failed, only counted by PubMaster
+  std::atomic<uint64_t> first_time = 0, last_time = 0, last_mono_time = 0;
+};
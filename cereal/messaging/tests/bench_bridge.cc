@@ -0,0 +1,101 @@
+// Publishes synthetic msgq traffic through a local MsgqToZmq bridge and reports
+// throughput and publish-to-receive latency on the ZMQ side.
+//
+// usage: bench_bridge [endpoints=20] [rate_hz=100] [seconds=10] [msg_size=4096] [bridge_threads=2]
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cereal/messaging/msgq_to_zmq.h"
+#include "cereal/services.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+ExitHandler do_exit;
+
+int main(int argc, char **argv) {
+  const int num_endpoints = argc > 1 ? atoi(argv[1]) : 20;
+  const int rate_hz = argc > 2 ? atoi(argv[2]) : 100;
+  const int seconds = argc > 3 ? atoi(argv[3]) : 10;
+  const size_t msg_size = argc > 4 ? atoi(argv[4]) : 4096;
+  const int bridge_threads = argc > 5 ? atoi(argv[5]) : 2;
+
+  std::vector<std::string> endpoints;
+  for (const auto &[name, _] : services) {
+    if (endpoints.size() == num_endpoints) break;
+    endpoints.push_back(name);
+  }
+
+  MsgqToZmq bridge(bridge_threads);
+  std::thread bridge_thread([&]() { bridge.run(endpoints, "127.0.0.1"); });
+
+  MSGQContext msgq_context;
+  ZMQContext zmq_context;
+  ZMQPoller poller;
+  std::vector<std::unique_ptr<MSGQPubSocket>> pub_socks;
+  std::vector<std::unique_ptr<ZMQSubSocket>> sub_socks;
+  for (const auto &endpoint : endpoints) {
+    pub_socks.emplace_back(std::make_unique<MSGQPubSocket>())->connect(&msgq_context, endpoint);
+    auto &sub = sub_socks.emplace_back(std::make_unique<ZMQSubSocket>());
+    sub->connect(&zmq_context, endpoint, "127.0.0.1", false);
+    poller.registerSocket(sub.get());
+  }
+  // give the bridge time to see the ZMQ subscribers and register its msgq sockets
+  util::sleep_for(1000);
+
+  // receive on a separate thread, the payload starts with the publish time
+  std::vector<uint64_t> latencies;
+  uint64_t received_bytes = 0;
+  std::atomic<bool> publishing = true;
+  std::thread recv_thread([&]() {
+    uint64_t last_rcv = nanos_since_boot();
+    while (publishing || nanos_since_boot() - last_rcv < 500 * 1e6) {
+      for (auto sock : poller.poll(100)) {
+        while (Message *msg = sock->receive(true)) {
+          last_rcv = nanos_since_boot();
+          latencies.push_back(last_rcv - *(uint64_t *)msg->getData());
+          received_bytes += msg->getSize();
+          delete msg;
+        }
+      }
+    }
+  });
+
+  std::string payload(std::max(msg_size, sizeof(uint64_t)), 'x');
+  uint64_t sent = 0;
+  const double start = millis_since_boot();
+  for (int frame = 0; frame < rate_hz * seconds && !do_exit; ++frame) {
+    for (auto &pub : pub_socks) {
+      *(uint64_t *)payload.data() = nanos_since_boot();
+      pub->send(payload.data(), payload.size());
+      ++sent;
+    }
+    if (rate_hz > 0) {
+      double next = start + (frame + 1) * 1000.0 / rate_hz;
+      util::sleep_for(std::max(0.0, next - millis_since_boot()));
+    }
+  }
+  const double elapsed = (millis_since_boot() - start) / 1000.0;
+  publishing = false;
+  recv_thread.join();
+
+  do_exit = true;
+  bridge_thread.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies.empty() ? 0.0 : latencies[std::min<size_t>(latencies.size() * p, latencies.size() - 1)] / 1e3;
+  };
+  printf("endpoints: %d, bridge threads: %d, msg size: %zu\n", num_endpoints, bridge_threads, payload.size());
+  printf("sent: %" PRIu64 ", received: %zu (%.1f%%)\n", sent, latencies.size(), 100.0 * latencies.size() / std::max<uint64_t>(sent, 1));
+  printf("throughput: %.0f msgs/s, %.2f MB/s\n", latencies.size() / elapsed, received_bytes / elapsed / 1e6);
+  printf("latency (us): p50 %.1f, p99 %.1f, max %.1f\n", percentile(0.5), percentile(0.99), percentile(1.0));
+  return 0;
+}
@@ -0,0 +1,44 @@
+// Compares SubMaster lookups by service name with lookups by cereal::Event::Which.
+//
+// usage: bench_socketmaster [services=30] [iterations=100000]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "common/timing.h"
+
+int main(int argc, char **argv) {
+  const size_t num_services = argc > 1 ? atoi(argv[1]) : 30;
+  const int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+
+  std::vector<const char *> names;
+  std::vector<cereal::Event::Which> which;
+  for (auto &[name, _] : services) {
+    if (names.size() == num_services) break;
+    names.push_back(name.c_str());
+    which.push_back(event_which(name.c_str()));
+  }
+  SubMaster sm(names);
+
+  uint64_t count = 0;
+  double start = millis_since_boot();
+  for (int i = 0; i < iterations; ++i) {
+    for (auto name : names) count += sm.rcv_frame(name) + sm.alive(name);
+  }
+  const double elapsed_string = millis_since_boot() - start;
+
+  start = millis_since_boot();
+  for (int i = 0; i < iterations; ++i) {
+    for (auto w : which) count += sm.rcv_frame(w) + sm.alive(w);
+  }
+  const double elapsed_which = millis_since_boot() - start;
+
+  const double lookups = 2.0 * iterations * names.size();
+  printf("SubMaster lookup (%zu services): string %.1f ns, cereal::Event::Which %.1f ns (checksum %" PRIu64 ")\n",
+         names.size(), elapsed_string / lookups * 1e6, elapsed_which / lookups * 1e6, count);
+  return 0;
+}
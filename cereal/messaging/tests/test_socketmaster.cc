@@ -0,0 +1,313 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "cereal/services.h"
+#include "common/util.h"
+#include "third_party/json11/json11.hpp"
+
+// count heap allocations made through operator new
+static std::atomic<uint64_t> heap_allocations = 0;
+
+void *operator new(size_t size) {
+  heap_allocations++;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+const char *BENCH_SERVICE = "customReservedRawData0";
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// heap-backed Message whose payload starts `offset` bytes into its buffer
+class TestMessage : public Message {
+public:
+  TestMessage(size_t offset = 0) : offset(offset) {}
+  void init(size_t size) { buf.resize(offset + size); }
+  void init(char *data, size_t size) {
+    init(size);
+    memcpy(getData(), data, size);
+  }
+  void close() { buf.clear(); }
+  size_t getSize() { return buf.size() - offset; }
+  char *getData() { return buf.data() + offset; }
+
+private:
+  size_t offset;
+  std::vector<char> buf;
+};
+
+}  // namespace
+
+TEST_CASE("AlignedBuffer::view") {
+  MessageBuilder msg;
+  msg.initEvent().initCustomReservedRawData0(1024);
+  auto bytes = msg.toBytes();
+
+  AlignedBuffer buf;
+  bool copied = true;
+
+  SECTION("aligned message is not copied") {
+    TestMessage m;
+    m.init((char *)bytes.begin(), bytes.size());
+    auto words = buf.view(&m, &copied);
+    REQUIRE_FALSE(copied);
+    REQUIRE((const char *)words.begin() == m.getData());
+    REQUIRE(words.size() * sizeof(capnp::word) == bytes.size());
+  }
+  SECTION("unaligned message falls back to a copy") {
+    TestMessage m(1);
+    m.init((char *)bytes.begin(), bytes.size());
+    auto words = buf.view(&m, &copied);
+    REQUIRE(copied);
+    REQUIRE((const char *)words.begin() != m.getData());
+    REQUIRE(memcmp(words.begin(), bytes.begin(), bytes.size()) == 0);
+  }
+}
+
+TEST_CASE("SubMaster zero-copy receive benchmark") {
+  const int iterations = 200;
+  const size_t payload_size = 1024 * 1024;
+
+  PubMaster pm({BENCH_SERVICE});
+  SubMaster sm({BENCH_SERVICE});
+  util::sleep_for(100);
+
+  MessageBuilder msg;
+  msg.initEvent().initCustomReservedRawData0(payload_size);
+  auto bytes = msg.toBytes();
+
+  // before: every message is copied into an AlignedBuffer
+  AlignedBuffer aligned_buf;
+  uint64_t copied_before = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    auto words = aligned_buf.align((const char *)bytes.begin(), bytes.size());
+    copied_before += bytes.size();
+    REQUIRE(words.size() > 0);
+  }
+  double elapsed_before = seconds_since(start);
+
+  // after: SubMaster reads in place
+  int received = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    pm.send(BENCH_SERVICE, bytes.begin(), bytes.size());
+    sm.update(1000);
+    received += sm.updated(BENCH_SERVICE);
+  }
+  double elapsed_after = seconds_since(start);
+
+  REQUIRE(received == iterations);
+  REQUIRE(sm[BENCH_SERVICE].getCustomReservedRawData0().size() == payload_size);
+  if (getenv("ZMQ") == nullptr) {
+    // msgq hands out heap-allocated, word-aligned payloads
+    REQUIRE(sm.bytes_copied == 0);
+  }
+
+  printf("AlignedBuffer copy: %.1f MB/s copied\n", copied_before / elapsed_before / 1e6);
+  printf("SubMaster zero-copy: %.1f MB/s copied (%d messages, %.1f ms)\n",
+         sm.bytes_copied / elapsed_after / 1e6, received, elapsed_after * 1e3);
+}
+
+TEST_CASE("PubMaster::send doesn't allocate after warm-up") {
+  const int warmup = 10;
+  const int iterations = 1000;
+
+  PubMaster pm({BENCH_SERVICE});
+  ReusableMessageBuilder builder;
+  std::vector<capnp::byte> buf;
+
+  auto build = [&](int i) -> MessageBuilder & {
+    MessageBuilder &msg = builder.reset();
+    auto data = msg.initEvent().initCustomReservedRawData0(1024 + (i % 7));
+    memset(data.begin(), i & 0xff, data.size());
+    return msg;
+  };
+
+  for (int i = 0; i < warmup; ++i) {
+    pm.send(BENCH_SERVICE, build(i));
+  }
+  uint64_t pm_allocations = pm.allocations;
+
+  SECTION("serialization") {
+    build(0).toBytes(buf);
+    uint64_t allocations = heap_allocations;
+    size_t capacity = buf.capacity();
+    size_t total_size = 0;
+    for (int i = 0; i < iterations; ++i) {
+      total_size += build(i).toBytes(buf).size();
+    }
+    REQUIRE(heap_allocations == allocations);
+    REQUIRE(total_size > iterations * 1024);
+    REQUIRE(buf.capacity() == capacity);
+    REQUIRE(builder.allocations == 0);
+  }
+  SECTION("send") {
+    // the service name is longer than the small string buffer, a lookup by name mustn't copy it
+    const auto which = event_which(BENCH_SERVICE);
+    uint64_t allocations = heap_allocations;
+    for (int i = 0; i < iterations; ++i) {
+      if (i % 2) {
+        pm.send(which, build(i));
+      } else {
+        pm.send(BENCH_SERVICE, build(i));
+      }
+    }
+    if (getenv("ZMQ") == nullptr) {
+      // zmq allocates its messages
+      REQUIRE(heap_allocations == allocations);
+    }
+    REQUIRE(pm.allocations == pm_allocations);
+    REQUIRE(builder.allocations == 0);
+  }
+}
+
+TEST_CASE("ReusableMessageBuilder counts messages that outgrow the first segment") {
+  ReusableMessageBuilder builder(64);
+  builder.reset().initEvent().initCustomReservedRawData0(16);
+  builder.reset().initEvent().initCustomReservedRawData0(64 * sizeof(capnp::word));
+  builder.reset();
+  REQUIRE(builder.allocations == 1);
+
+  // referenced external data doesn't count, like the payload of encoder packets
+  std::vector<capnp::byte> payload(64 * 1024);
+  auto &msg = builder.reset();
+  msg.initEvent().initRoadEncodeData().adoptData(msg.getOrphanage().referenceExternalData(
+      capnp::Data::Reader(payload.data(), payload.size())));
+  builder.reset();
+  REQUIRE(builder.allocations == 1);
+
+  // the recycled segment is zeroed before it is reused
+  builder.reset().initEvent(false);
+  auto event = builder.reset().initRoot<cereal::Event>();
+  REQUIRE(event.getValid());
+  REQUIRE(event.getLogMonoTime() == 0);
+}
+
+TEST_CASE("SubMaster lookup by cereal::Event::Which matches lookup by name") {
+  const size_t num_services = 30;
+
+  std::vector<const char *> names;
+  std::vector<cereal::Event::Which> which;
+  for (auto &[name, _] : services) {
+    if (names.size() == num_services) break;
+    names.push_back(name.c_str());
+    which.push_back(event_which(name.c_str()));
+  }
+  SubMaster sm(names);
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    REQUIRE(&sm[names[i]] == &sm[which[i]]);
+    REQUIRE(sm.rcv_frame(names[i]) == sm.rcv_frame(which[i]));
+    REQUIRE(sm.alive(names[i]) == sm.alive(which[i]));
+    REQUIRE(sm.updated(names[i]) == sm.updated(which[i]));
+  }
+}
+
+TEST_CASE("SubMaster drain policies") {
+  const int num_msgs = 5;
+  PubMaster pm({BENCH_SERVICE});
+  SubMaster sm({BENCH_SERVICE});
+  util::sleep_for(100);
+
+  auto publish = [&]() {
+    for (int i = 0; i < num_msgs; ++i) {
+      MessageBuilder msg;
+      msg.initEvent().initCustomReservedRawData0(1)[0] = i;
+      pm.send(BENCH_SERVICE, msg);
+    }
+  };
+  auto last_value = [&]() { return sm[BENCH_SERVICE].getCustomReservedRawData0()[0]; };
+
+  SECTION("NEXT") {
+    publish();
+    sm.update(1000);
+    REQUIRE(sm.updated(BENCH_SERVICE));
+    REQUIRE(last_value() == 0);
+    sm.update(0);
+    REQUIRE(last_value() == 1);
+    REQUIRE(sm.conflated(BENCH_SERVICE) == 0);
+  }
+  SECTION("LATEST") {
+    sm.setDrainPolicy(BENCH_SERVICE, DrainPolicy::LATEST);
+    publish();
+    sm.update(1000);
+    REQUIRE(sm.updated(BENCH_SERVICE));
+    REQUIRE(last_value() == num_msgs - 1);
+    REQUIRE(sm.dropped(BENCH_SERVICE) == num_msgs - 1);
+    REQUIRE(sm.conflated(BENCH_SERVICE) == 1);
+    sm.update(0);
+    REQUIRE_FALSE(sm.updated(BENCH_SERVICE));
+  }
+  SECTION("ALL") {
+    std::vector<int> values;
+    sm.setDrainPolicy(BENCH_SERVICE, DrainPolicy::ALL, [&](const char *name, cereal::Event::Reader event) {
+      REQUIRE(strcmp(name, BENCH_SERVICE) == 0);
+      values.push_back(event.getCustomReservedRawData0()[0]);
+    });
+    publish();
+    sm.update(1000);
+    REQUIRE(values == std::vector<int>{0, 1, 2, 3, 4});
+    REQUIRE(last_value() == num_msgs - 1);
+    REQUIRE(sm.dropped(BENCH_SERVICE) == 0);
+    REQUIRE(sm.conflated(BENCH_SERVICE) == 1);
+  }
+}
+
+TEST_CASE("SubMaster/PubMaster stats") {
+  const int num_msgs = 10;
+  PubMaster pm({BENCH_SERVICE});
+  SubMaster sm({BENCH_SERVICE});
+  pm.enableStats();
+  sm.enableStats();
+  util::sleep_for(100);
+
+  for (int i = 0; i < num_msgs; ++i) {
+    MessageBuilder msg;
+    msg.initEvent().initCustomReservedRawData0(100);
+    pm.send(BENCH_SERVICE, msg);
+    sm.update(1000);
+    REQUIRE(sm.updated(BENCH_SERVICE));
+  }
+
+  std::string err;
+  auto sub_stats = json11::Json::parse(sm.dumpStats(), err)[BENCH_SERVICE];
+  REQUIRE(err.empty());
+  REQUIRE(sub_stats["count"].int_value() == num_msgs);
+  REQUIRE(sub_stats["latency_us"]["count"].int_value() == num_msgs);
+  REQUIRE(sub_stats["size_bytes"]["max"].int_value() > 100);
+
+  auto pub_stats = json11::Json::parse(pm.dumpStats(), err)[BENCH_SERVICE];
+  REQUIRE(err.empty());
+  REQUIRE(pub_stats["count"].int_value() == num_msgs);
+  REQUIRE(pub_stats["send_failures"].int_value() == 0);
+}
+
+TEST_CASE("ServiceStats detects gaps in publish times") {
+  const uint64_t period = 10 * 1e6;  // 100 Hz
+  ServiceStats stats(100);
+  for (int i = 0; i < 100; ++i) {
+    if (i == 50 || i == 51) continue;
+    stats.record(i * period + 1000, i * period, 1000, 64);
+  }
+  REQUIRE(stats.gaps == 2);
+  REQUIRE(stats.send_failures == 0);
+  REQUIRE(stats.latency_us.count() == 98);
+  REQUIRE(stats.latency_us.max() == 1);
+  REQUIRE(stats.jitter_us.max() == 2 * period / 1000);
+  REQUIRE(stats.rate() == Approx(100).epsilon(0.05));
+}
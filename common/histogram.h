@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "third_party/json11/json11.hpp"
+
+// log2-bucketed histogram. add() and the readers may run on different threads.
+class Histogram {
+public:
+  static constexpr int NUM_BUCKETS = 40;
+
+  inline void add(uint64_t value) {
+    // bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+    int bucket = value == 0 ? 0 : std::min(64 - __builtin_clzll(value), NUM_BUCKETS - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t prev = max_.load(std::memory_order_relaxed);
+    while (value > prev && !max_.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {}
+  }
+
+  inline uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  inline uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  inline double mean() const { return count() ? (double)sum_.load(std::memory_order_relaxed) / count() : 0; }
+
+  // upper bound of the bucket holding the p-th percentile, p in [0, 1]
+  uint64_t percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t target = std::max<uint64_t>(1, std::ceil(total * p)), seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= target) return i == 0 ? 0 : std::min<uint64_t>((1ULL << i) - 1, max());
+    }
+    return max();
+  }
+
+private:
+  std::atomic<uint64_t> buckets_[NUM_BUCKETS] = {};
+  std::atomic<uint64_t> count_ = 0, sum_ = 0, max_ = 0;
+};
+
+inline json11::Json histogram_json(const Histogram &h) {
+  return json11::Json::object{
+    {"count", (double)h.count()},
+    {"mean", h.mean()},
+    {"p50", (double)h.percentile(0.5)},
+    {"p99", (double)h.percentile(0.99)},
+    {"max", (double)h.max()},
+  };
+}
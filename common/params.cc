@@ -1,15 +1,21 @@
 #include "common/params.h"
 
 #include <dirent.h>
+#include <poll.h>
 #include <sys/file.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
 
 #include <algorithm>
 #include <cassert>
 #include <csignal>
+#include <thread>
 #include <unordered_map>
 
 #include "common/params_keys.h"
-#include "common/queue.h"
+#include "common/params_log.h"
 #include "common/swaglog.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
@@ -21,16 +27,6 @@ void params_sig_handler(int signal) {
   params_do_exit = 1;
 }
 
-int fsync_dir(const std::string &path) {
-  int result = -1;
-  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY, 0755));
-  if (fd >= 0) {
-    result = HANDLE_EINTR(fsync(fd));
-    HANDLE_EINTR(close(fd));
-  }
-  return result;
-}
-
 bool create_params_path(const std::string &param_path, const std::string &key_path) {
   // Make sure params path exists
   if (!util::file_exists(param_path) && !util::create_directories(param_path, 0775)) {
@@ -74,33 +70,209 @@ std::string ensure_params_path(const std::string &prefix, const std::string &pat
   return params_path;
 }
 
-class FileLock {
+// Writes value to a new temp file in params_path and fsyncs it. Returns 0 on success.
+int write_tmp_file(const std::string &params_path, const char *value, size_t value_size, std::string &tmp_path) {
+  tmp_path = params_path + "/.tmp_value_XXXXXX";
+  int tmp_fd = mkstemp((char*)tmp_path.c_str());
+  if (tmp_fd < 0) return -1;
+
+  int result = 0;
+  // Write value to temp.
+  ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
+  if (bytes_written < 0 || (size_t)bytes_written != value_size) {
+    result = -20;
+  } else {
+    // fsync to force persist the changes.
+    result = HANDLE_EINTR(fsync(tmp_fd));
+  }
+
+  close(tmp_fd);
+  if (result != 0) {
+    ::unlink(tmp_path.c_str());
+  }
+  return result;
+}
+
+#ifdef __linux__
+// inotify watch on a params directory
+class ParamsWatch {
 public:
-  FileLock(const std::string &fn) {
-    fd_ = HANDLE_EINTR(open(fn.c_str(), O_CREAT, 0775));
-    if (fd_ < 0 || HANDLE_EINTR(flock(fd_, LOCK_EX)) < 0) {
-      LOGE("Failed to lock file %s, errno=%d", fn.c_str(), errno);
+  ParamsWatch(const std::string &dir) : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+    if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), IN_MOVED_TO | IN_MOVED_FROM | IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE) < 0) {
+      LOGE("Failed to watch params directory %s, errno=%d", dir.c_str(), errno);
     }
   }
-  ~FileLock() { close(fd_); }
 
-private:
-  int fd_ = -1;
+  // calls f with the name of each changed key, or nullptr if events were lost
+  template <typename F>
+  void read_events(F f) {
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = HANDLE_EINTR(read(fd, buf, sizeof(buf)))) > 0) {
+      for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+        auto event = (struct inotify_event *)p;
+        if (event->mask & IN_Q_OVERFLOW) {
+          f(nullptr);
+        } else if (event->len > 0) {
+          f(event->name);
+        }
+      }
+    }
+  }
+
+  unique_fd fd;
 };
+#endif
 
 } // namespace
 
+int fsync_dir(const std::string &path) {
+  int result = -1;
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY, 0755));
+  if (fd >= 0) {
+    result = HANDLE_EINTR(fsync(fd));
+    HANDLE_EINTR(close(fd));
+  }
+  return result;
+}
+
+FileLock::FileLock(const std::string &fn) {
+  fd_ = HANDLE_EINTR(open(fn.c_str(), O_CREAT, 0775));
+  if (fd_ < 0 || HANDLE_EINTR(flock(fd_, LOCK_EX)) < 0) {
+    LOGE("Failed to lock file %s, errno=%d", fn.c_str(), errno);
+  }
+}
+
+FileLock::~FileLock() { close(fd_); }
+
+// Values of one params directory shared by all cached Params in this process.
+// Entries are dropped when inotify reports that a key changed on disk. With the
+// log backend, dir is the directory of the log and any change of the log file
+// drops all entries.
+class ParamsCache {
+public:
+  static std::shared_ptr<ParamsCache> get(const std::string &dir, const std::string &log_name = {}) {
+    static std::mutex caches_lock;
+    static std::map<std::string, std::weak_ptr<ParamsCache>> caches;
+
+    std::scoped_lock lk(caches_lock);
+    auto &entry = caches[dir + "/" + log_name];
+    auto cache = entry.lock();
+    if (!cache) {
+      cache = std::make_shared<ParamsCache>(dir, log_name);
+      entry = cache;
+    }
+    return cache;
+  }
+
+#ifdef __linux__
+  ParamsCache(const std::string &dir, const std::string &log_name) : log_name(log_name), watch(dir), exit_fd(eventfd(0, EFD_CLOEXEC)) {
+    thread = std::thread(&ParamsCache::watchThread, this);
+  }
+
+  ~ParamsCache() {
+    uint64_t val = 1;
+    HANDLE_EINTR(write(exit_fd, &val, sizeof(val)));
+    thread.join();
+  }
+#else
+  ParamsCache(const std::string &dir, const std::string &log_name) {}
+#endif
+
+  // load reads the value from the backend on a miss
+  template <typename F>
+  std::string read(const std::string &key, F load) {
+    uint64_t read_version;
+    {
+      std::scoped_lock lk(lock);
+      if (auto it = values.find(key); it != values.end()) return it->second;
+      read_version = version;
+    }
+    std::string value = load();
+
+    // don't cache the value if anything changed while reading it
+    std::scoped_lock lk(lock);
+    if (read_version == version) values[key] = value;
+    return value;
+  }
+
+  void invalidate(const char *key) {
+    std::scoped_lock lk(lock);
+    if (key) {
+      values.erase(key);
+    } else {
+      values.clear();
+    }
+    ++version;
+  }
 
-Params::Params(const std::string &path) {
+private:
+#ifdef __linux__
+  void watchThread() {
+    util::set_thread_name("params_cache");
+    struct pollfd fds[] = {{.fd = watch.fd, .events = POLLIN}, {.fd = exit_fd, .events = POLLIN}};
+    while (true) {
+      if (poll(fds, std::size(fds), -1) < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      if (fds[1].revents) break;
+      watch.read_events([this](const char *name) {
+        if (log_name.empty()) {
+          invalidate(name);
+        } else if (!name || log_name == name) {
+          invalidate(nullptr);
+        }
+      });
+    }
+  }
+
+  const std::string log_name;
+  ParamsWatch watch;
+  unique_fd exit_fd;
+  std::thread thread;
+#endif
+
+  std::mutex lock;
+  std::unordered_map<std::string, std::string> values;
+  uint64_t version = 0;
+};
+
+
+Params::Params(const std::string &path, bool cached) {
   params_prefix = "/" + util::getenv("OPENPILOT_PREFIX", "d");
   params_path = ensure_params_path(params_prefix, path);
+  if (util::file_exists(getLogPath())) {
+    log = ParamsLog::get(getLogPath(), params_path + "/.lock");
+  }
+  if (cached) enableCache();
+}
+
+void Params::enableCache() {
+#ifdef __linux__
+  cache = log ? ParamsCache::get(params_path, params_prefix.substr(1) + ".log") : ParamsCache::get(getParamPath());
+#endif
+}
+
+void Params::migrateToLog() {
+  if (log) return;
+  log = ParamsLog::get(getLogPath(), params_path + "/.lock", getParamPath());
+  if (cache) enableCache();
+}
+
+int Params::writeLog(const std::map<std::string, std::optional<std::string>> &changes) {
+  int result = log->write(changes);
+  if (cache) {
+    for (auto &[key, _] : changes) cache->invalidate(key.c_str());
+  }
+  return result;
 }
 
 Params::~Params() {
   if (future.valid()) {
     future.wait();
   }
-  assert(queue.empty());
+  assert(pending.empty());
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -134,41 +306,76 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   // 3) fsync() the temp file
   // 4) rename the temp file to the real name
   // 5) fsync() the containing directory
-  std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
-  int tmp_fd = mkstemp((char*)tmp_path.c_str());
-  if (tmp_fd < 0) return -1;
+  if (log) return writeLog({{key, std::string(value, value_size)}});
 
-  int result = -1;
-  do {
-    // Write value to temp.
-    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
-    if (bytes_written < 0 || (size_t)bytes_written != value_size) {
-      result = -20;
-      break;
-    }
-
-    // fsync to force persist the changes.
-    if ((result = HANDLE_EINTR(fsync(tmp_fd))) < 0) break;
+  std::string tmp_path;
+  int result = write_tmp_file(params_path, value, value_size, tmp_path);
+  if (result != 0) return result;
 
+  do {
     FileLock file_lock(params_path + "/.lock");
 
     // Move temp into place.
     if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) < 0) break;
+    if (cache) cache->invalidate(key);
 
     // fsync parent directory
     result = fsync_dir(getParamPath());
   } while (false);
 
-  close(tmp_fd);
   if (result != 0) {
     ::unlink(tmp_path.c_str());
   }
   return result;
 }
 
+int Params::putMany(const std::map<std::string, std::string> &values) {
+  return putBatch(values);
+}
+
+int Params::putBatch(const std::map<std::string, std::string> &values) {
+  if (log) return writeLog({values.begin(), values.end()});
+
+  // Same steps as put(), but all values are moved into place under one lock
+  // and the directory is only fsync'd once. A value that fails to be written
+  // doesn't stop the others, the first error is returned.
+  std::vector<std::pair<std::string, std::string>> tmp_files;  // (key, tmp_path)
+  int result = 0;
+  for (auto &[key, value] : values) {
+    std::string tmp_path;
+    if (int ret = write_tmp_file(params_path, value.data(), value.size(), tmp_path); ret != 0) {
+      if (result == 0) result = ret;
+      continue;
+    }
+    tmp_files.emplace_back(key, tmp_path);
+  }
+
+  if (!tmp_files.empty()) {
+    FileLock file_lock(params_path + "/.lock");
+    size_t renamed = 0;
+    for (auto &[key, tmp_path] : tmp_files) {
+      if (int ret = rename(tmp_path.c_str(), getParamPath(key).c_str()); ret != 0) {
+        if (result == 0) result = ret;
+        ::unlink(tmp_path.c_str());
+        continue;
+      }
+      ++renamed;
+      if (cache) cache->invalidate(key.c_str());
+    }
+    if (renamed > 0) {
+      int fsync_result = fsync_dir(getParamPath());
+      if (result == 0) result = fsync_result;
+    }
+  }
+  return result;
+}
+
 int Params::remove(const std::string &key) {
+  if (log) return writeLog({{key, std::nullopt}});
+
   FileLock file_lock(params_path + "/.lock");
   int result = unlink(getParamPath(key).c_str());
+  if (cache) cache->invalidate(key.c_str());
   if (result != 0) {
     return result;
   }
@@ -177,33 +384,61 @@ int Params::remove(const std::string &key) {
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
-    return util::read_file(getParamPath(key));
+    auto load = [&]() { return log ? log->get(key) : util::read_file(getParamPath(key)); };
+    return cache ? cache->read(key, load) : load();
   } else {
     // blocking read until successful
     params_do_exit = 0;
     void (*prev_handler_sigint)(int) = std::signal(SIGINT, params_sig_handler);
     void (*prev_handler_sigterm)(int) = std::signal(SIGTERM, params_sig_handler);
 
+#ifdef __linux__
+    // wake up as soon as a value is moved into place instead of polling the file
+    ParamsWatch watch(log ? params_path : getParamPath());
+#endif
+
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+      if (value = log ? log->get(key) : util::read_file(getParamPath(key)); !value.empty()) {
         break;
       }
+#ifdef __linux__
+      struct pollfd fds[] = {{.fd = watch.fd, .events = POLLIN}};
+      if (watch.fd < 0) {
+        util::sleep_for(100);  // 0.1 s
+      } else if (poll(fds, 1, 100) > 0) {
+        watch.read_events([](const char *) {});
+      }
+#else
       util::sleep_for(100);  // 0.1 s
+#endif
     }
 
     std::signal(SIGINT, prev_handler_sigint);
     std::signal(SIGTERM, prev_handler_sigterm);
+    if (cache && !value.empty()) cache->invalidate(key.c_str());
     return value;
   }
 }
 
 std::map<std::string, std::string> Params::readAll() {
+  if (log) return log->readAll();
+
   FileLock file_lock(params_path + "/.lock");
   return util::read_files_in_dir(getParamPath());
 }
 
 void Params::clearAll(ParamKeyFlag key_flag) {
+  if (log) {
+    std::map<std::string, std::optional<std::string>> removed;
+    for (auto &[key, _] : log->readAll()) {
+      auto it = keys.find(key);
+      if (it == keys.end() || (it->second.flags & key_flag)) removed[key] = std::nullopt;
+    }
+    writeLog(removed);
+    return;
+  }
+
   FileLock file_lock(params_path + "/.lock");
 
   // 1) delete params of key_flag
@@ -220,23 +455,49 @@ void Params::clearAll(ParamKeyFlag key_flag) {
     }
     closedir(d);
   }
+  if (cache) cache->invalidate(nullptr);
 
   fsync_dir(getParamPath());
 }
 
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
+  std::scoped_lock lk(pending_lock);
+  ++write_stats.queued;
+  if (!pending.insert_or_assign(key, val).second) {
+    ++write_stats.coalesced;
+  }
   // start thread on demand
-  if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+  if (!writer_running) {
+    writer_running = true;
     future = std::async(std::launch::async, &Params::asyncWriteThread, this);
   }
 }
 
+ParamsWriteStats Params::getWriteStats() {
+  std::scoped_lock lk(pending_lock);
+  return write_stats;
+}
+
 void Params::asyncWriteThread() {
-  // TODO: write the latest one if a key has multiple values in the queue.
-  std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
-    // Params::put is Thread-Safe
-    put(p.first, p.second);
+  while (true) {
+    // take everything queued so far, repeated writes to a key were already collapsed
+    std::map<std::string, std::string> values;
+    {
+      std::scoped_lock lk(pending_lock);
+      if (pending.empty()) {
+        writer_running = false;
+        return;
+      }
+      values.swap(pending);
+    }
+
+    int result = putBatch(values);
+    if (result != 0) {
+      LOGE("Failed to write %zu params, result=%d", values.size(), result);
+    }
+
+    std::scoped_lock lk(pending_lock);
+    write_stats.written += values.size();
+    write_stats.batches += 1;
   }
 }
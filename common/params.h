@@ -2,14 +2,14 @@
 
 #include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
-#include "common/queue.h"
-
 enum ParamKeyFlag {
   PERSISTENT = 0x02,
   CLEAR_ON_MANAGER_START = 0x04,
@@ -37,9 +37,21 @@ struct ParamKeyAttributes {
   std::optional<std::string> default_value = std::nullopt;
 };
 
+struct ParamsWriteStats {
+  uint64_t queued = 0;     // putNonBlocking calls
+  uint64_t coalesced = 0;  // values replaced by a newer one for the same key before being written
+  uint64_t written = 0;    // values written to disk
+  uint64_t batches = 0;    // lock acquisitions and directory fsyncs
+};
+
+class ParamsCache;
+class ParamsLog;
+
 class Params {
 public:
-  explicit Params(const std::string &path = {});
+  // cached: keep values read by get() in memory, invalidated through inotify when a value changes.
+  // The values are read from the log backend if its file exists, otherwise from one file per key.
+  explicit Params(const std::string &path = {}, bool cached = false);
   ~Params();
   // Not copyable.
   Params(const Params&) = delete;
@@ -53,6 +65,13 @@ public:
   inline std::string getParamPath(const std::string &key = {}) {
     return params_path + params_prefix + (key.empty() ? "" : "/" + key);
   }
+  inline std::string getLogPath() {
+    return params_path + params_prefix + ".log";
+  }
+
+  // Moves the values into a new log backend, see ParamsLog. Params created afterwards use
+  // the log, so this should happen before other processes write params.
+  void migrateToLog();
 
   // Delete a value
   int remove(const std::string &key);
@@ -73,18 +92,29 @@ public:
   inline int putBool(const std::string &key, bool val) {
     return put(key.c_str(), val ? "1" : "0", 1);
   }
+  // writes all values atomically with the log backend
+  int putMany(const std::map<std::string, std::string> &values);
   void putNonBlocking(const std::string &key, const std::string &val);
   inline void putBoolNonBlocking(const std::string &key, bool val) {
     putNonBlocking(key, val ? "1" : "0");
   }
+  ParamsWriteStats getWriteStats();
 
 private:
+  int putBatch(const std::map<std::string, std::string> &values);
+  int writeLog(const std::map<std::string, std::optional<std::string>> &changes);
+  void enableCache();
   void asyncWriteThread();
 
   std::string params_path;
   std::string params_prefix;
+  std::shared_ptr<ParamsCache> cache;
+  std::shared_ptr<ParamsLog> log;
 
-  // for nonblocking write
+  // for nonblocking write, only the latest value of each key is kept
   std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  std::mutex pending_lock;
+  std::map<std::string, std::string> pending;
+  bool writer_running = false;
+  ParamsWriteStats write_stats;
 };
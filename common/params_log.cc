@@ -0,0 +1,259 @@
+#include "common/params_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include "common/swaglog.h"
+#include "common/util.h"
+
+namespace {
+
+constexpr char MAGIC[8] = {'O', 'P', 'P', 'A', 'R', 'A', 'M', '1'};
+// only compact logs that are larger than this and twice the size of the live data
+constexpr size_t COMPACT_MIN_SIZE = 256 * 1024;
+
+enum : uint8_t { OP_PUT = 1, OP_REMOVE = 2 };
+
+// record: crc32 of the payload | payload size | payload
+// payload: entries of op (1) | key size (4) | value size (4) | key | value
+struct RecordHeader {
+  uint32_t crc;
+  uint32_t size;
+};
+constexpr size_t ENTRY_HEADER_SIZE = 1 + 4 + 4;
+
+uint32_t crc32(const char *data, size_t size) {
+  static const auto table = []() {
+    std::array<uint32_t, 256> t = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFF;
+}
+
+std::string encode_record(const std::map<std::string, std::optional<std::string>> &changes) {
+  std::string record(sizeof(RecordHeader), '\0');
+  for (auto &[key, value] : changes) {
+    uint8_t op = value ? OP_PUT : OP_REMOVE;
+    uint32_t key_size = key.size(), value_size = value ? value->size() : 0;
+    record.append((const char *)&op, sizeof(op));
+    record.append((const char *)&key_size, sizeof(key_size));
+    record.append((const char *)&value_size, sizeof(value_size));
+    record.append(key);
+    if (value) record.append(*value);
+  }
+  RecordHeader header = {.size = uint32_t(record.size() - sizeof(RecordHeader))};
+  header.crc = crc32(record.data() + sizeof(RecordHeader), header.size);
+  memcpy(record.data(), &header, sizeof(header));
+  return record;
+}
+
+int write_all(int fd, const std::string &data, off_t offset) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t ret = HANDLE_EINTR(pwrite(fd, data.data() + written, data.size() - written, offset + written));
+    if (ret < 0) return -1;
+    written += ret;
+  }
+  return 0;
+}
+
+std::string dirname(const std::string &path) {
+  return path.substr(0, path.find_last_of('/'));
+}
+
+// Writes contents to a temp file next to path, fsyncs it and renames it into place.
+int replace_file(const std::string &path, const std::string &contents) {
+  std::string tmp_path = dirname(path) + "/.tmp_log_XXXXXX";
+  int tmp_fd = mkstemp((char *)tmp_path.c_str());
+  if (tmp_fd < 0) return -1;
+
+  int result = -1;
+  if (write_all(tmp_fd, contents, 0) == 0 && HANDLE_EINTR(fsync(tmp_fd)) == 0 &&
+      rename(tmp_path.c_str(), path.c_str()) == 0) {
+    result = fsync_dir(dirname(path));
+  }
+  close(tmp_fd);
+  if (result != 0) ::unlink(tmp_path.c_str());
+  return result;
+}
+
+} // namespace
+
+std::shared_ptr<ParamsLog> ParamsLog::get(const std::string &path, const std::string &lock_path, const std::string &migrate_dir) {
+  static std::mutex logs_lock;
+  static std::map<std::string, std::weak_ptr<ParamsLog>> logs;
+
+  std::scoped_lock lk(logs_lock);
+  auto log = logs[path].lock();
+  if (!log) {
+    log = std::make_shared<ParamsLog>(path, lock_path, migrate_dir);
+    logs[path] = log;
+  }
+  return log;
+}
+
+ParamsLog::ParamsLog(const std::string &path, const std::string &lock_path, const std::string &migrate_dir)
+    : path(path), lock_path(lock_path) {
+  FileLock file_lock(lock_path);
+  if (!util::file_exists(path)) {
+    // seed the new log with the values of the directory backend in one transaction
+    std::map<std::string, std::optional<std::string>> values;
+    if (!migrate_dir.empty()) {
+      for (auto &[key, value] : util::read_files_in_dir(migrate_dir)) values[key] = value;
+    }
+    std::string contents(MAGIC, sizeof(MAGIC));
+    if (!values.empty()) contents += encode_record(values);
+    if (replace_file(path, contents) != 0) {
+      throw std::runtime_error(util::string_format("Failed to create params log %s, errno=%d", path.c_str(), errno));
+    }
+  }
+  std::scoped_lock lk(lock);
+  if (!refresh()) {
+    throw std::runtime_error(util::string_format("Failed to open params log %s, errno=%d", path.c_str(), errno));
+  }
+}
+
+ParamsLog::~ParamsLog() {
+  unmap();
+  if (fd >= 0) close(fd);
+}
+
+void ParamsLog::unmap() {
+  if (map) munmap(map, map_size);
+  map = nullptr;
+  map_size = 0;
+}
+
+// Catches up with the file on disk: reopens it after a compaction, remaps it
+// after appends and applies the new records to the index. Must hold lock.
+bool ParamsLog::refresh() {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+
+  if (fd < 0 || st.st_ino != inode) {
+    int new_fd = HANDLE_EINTR(open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (new_fd < 0 || fstat(new_fd, &st) != 0) {
+      if (new_fd >= 0) close(new_fd);
+      return false;
+    }
+    unmap();
+    if (fd >= 0) close(fd);
+    fd = new_fd;
+    inode = st.st_ino;
+    index.clear();
+    live_size = sizeof(MAGIC);
+    valid_end = sizeof(MAGIC);
+  }
+
+  // the file never shrinks in place, compaction always replaces it
+  if ((size_t)st.st_size != map_size) {
+    void *new_map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (new_map == MAP_FAILED) return false;
+    unmap();
+    map = (char *)new_map;
+    map_size = st.st_size;
+    if (map_size < sizeof(MAGIC) || memcmp(map, MAGIC, sizeof(MAGIC)) != 0) {
+      LOGE("Invalid params log %s", path.c_str());
+      return false;
+    }
+  }
+
+  scan();
+  return true;
+}
+
+void ParamsLog::scan() {
+  while (valid_end + sizeof(RecordHeader) <= map_size) {
+    RecordHeader header;
+    memcpy(&header, map + valid_end, sizeof(header));
+    const size_t begin = valid_end + sizeof(header), end = begin + header.size;
+    if (end > map_size || crc32(map + begin, header.size) != header.crc) {
+      break;  // torn or in-progress append
+    }
+
+    for (size_t pos = begin; pos + ENTRY_HEADER_SIZE <= end;) {
+      uint8_t op;
+      uint32_t key_size, value_size;
+      memcpy(&op, map + pos, 1);
+      memcpy(&key_size, map + pos + 1, 4);
+      memcpy(&value_size, map + pos + 5, 4);
+      pos += ENTRY_HEADER_SIZE;
+      if (pos + key_size + value_size > end) break;
+
+      std::string key(map + pos, key_size);
+      if (auto it = index.find(key); it != index.end()) {
+        live_size -= ENTRY_HEADER_SIZE + key.size() + it->second.second;
+        index.erase(it);
+      }
+      if (op == OP_PUT) {
+        index[key] = {pos + key_size, value_size};
+        live_size += ENTRY_HEADER_SIZE + key_size + value_size;
+      }
+      pos += key_size + value_size;
+    }
+    valid_end = end;
+  }
+}
+
+std::string ParamsLog::get(const std::string &key) {
+  std::scoped_lock lk(lock);
+  if (!refresh()) return {};
+  auto it = index.find(key);
+  return it != index.end() ? std::string(map + it->second.first, it->second.second) : std::string{};
+}
+
+std::map<std::string, std::string> ParamsLog::readAll() {
+  std::scoped_lock lk(lock);
+  std::map<std::string, std::string> ret;
+  if (refresh()) {
+    for (auto &[key, value] : index) ret[key] = std::string(map + value.first, value.second);
+  }
+  return ret;
+}
+
+int ParamsLog::write(const std::map<std::string, std::optional<std::string>> &changes) {
+  if (changes.empty()) return 0;
+
+  std::scoped_lock lk(lock);
+  FileLock file_lock(lock_path);
+  if (!refresh()) return -1;
+
+  // appending at valid_end also overwrites a torn record left by a crash
+  if (write_all(fd, encode_record(changes), valid_end) != 0) return -1;
+  if (HANDLE_EINTR(fdatasync(fd)) != 0) return -1;
+  if (!refresh()) return -1;
+
+  if (valid_end > COMPACT_MIN_SIZE && valid_end > 2 * (live_size + sizeof(RecordHeader))) {
+    if (int result = compact(); result != 0) {
+      LOGE("Failed to compact params log %s, errno=%d", path.c_str(), errno);
+    }
+  }
+  return 0;
+}
+
+// Rewrites the live entries as one record into a new file. Must hold both locks.
+int ParamsLog::compact() {
+  std::map<std::string, std::optional<std::string>> values;
+  for (auto &[key, value] : index) values[key] = std::string(map + value.first, value.second);
+
+  std::string contents(MAGIC, sizeof(MAGIC));
+  if (!values.empty()) contents += encode_record(values);
+  int result = replace_file(path, contents);
+  refresh();
+  return result;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Params backend that keeps every key in one append-only file.
+//
+// The file is a magic header followed by checksummed records, each holding one
+// transaction of puts and removes. A record is applied all-or-nothing, so a torn
+// record at the end of the file (crash during an append) fails its checksum and
+// is ignored, and the next writer overwrites it. Appends are fdatasync'd before
+// returning, which gives the same durability as the rename+fsync of the directory
+// backend. Once the file is much larger than the live data it is compacted into
+// a new file that is renamed into place.
+//
+// Readers mmap the file and keep an index of key -> value offset, catching up on
+// records appended by other processes on each access.
+class ParamsLog {
+public:
+  // the log of path, shared by all Params in this process
+  static std::shared_ptr<ParamsLog> get(const std::string &path, const std::string &lock_path, const std::string &migrate_dir = {});
+
+  // migrate_dir: directory backend whose values seed a newly created log
+  ParamsLog(const std::string &path, const std::string &lock_path, const std::string &migrate_dir = {});
+  ~ParamsLog();
+  ParamsLog(const ParamsLog&) = delete;
+  ParamsLog& operator=(const ParamsLog&) = delete;
+
+  std::string get(const std::string &key);
+  std::map<std::string, std::string> readAll();
+  // applies all changes in one transaction, std::nullopt removes the key
+  int write(const std::map<std::string, std::optional<std::string>> &changes);
+
+private:
+  bool refresh();
+  void scan();
+  void unmap();
+  int compact();
+
+  const std::string path, lock_path;
+  std::mutex lock;
+  int fd = -1;
+  ino_t inode = 0;
+  char *map = nullptr;
+  size_t map_size = 0;
+  size_t valid_end = 0;   // end of the last valid record
+  size_t live_size = 0;   // bytes the live entries would take in a compacted log
+  std::unordered_map<std::string, std::pair<size_t, size_t>> index;  // key -> (offset, size) of the value
+};
+
+// shared with the directory backend, defined in params.cc
+int fsync_dir(const std::string &path);
+
+class FileLock {
+public:
+  FileLock(const std::string &fn);
+  ~FileLock();
+
+private:
+  int fd_ = -1;
+};
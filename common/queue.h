@@ -1,8 +1,24 @@
 #pragma once
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
 #include <queue>
+#include <thread>
 
 template <class T>
 class SafeQueue {
@@ -50,3 +66,226 @@ private:
   std::condition_variable cv;
   std::queue<T> q;
 };
+
+// Bounded lock-free ring queues. RingQueue<T, false> (SpscQueue) allows one
+// producer thread, RingQueue<T, true> (MpscQueue) any number; both allow one
+// consumer thread. Elements are moved in and out of preallocated slots, so T
+// may be move-only and push/pop never allocate. The blocking calls sleep on a
+// futex, and wake-ups only cost a syscall when the other side is waiting.
+namespace queue_detail {
+
+constexpr size_t CACHE_LINE = 64;
+
+class Waiter {
+public:
+  static constexpr int SPIN_COUNT = 64;
+
+  // Waits until ready() returns true or timeout_ms (< 0: forever) expires.
+  template <class Pred>
+  bool wait(Pred ready, int timeout_ms) {
+    if (ready()) return true;
+    if (timeout_ms == 0) return false;
+    // spin a little first, the other side is usually about to make progress
+    for (int i = 0; i < SPIN_COUNT; ++i) {
+      if (i >= SPIN_COUNT / 2) std::this_thread::yield();
+      if (ready()) return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    waiters_.fetch_add(1);
+    bool ok = false;
+    while (true) {
+      const uint32_t seq = seq_.load(std::memory_order_acquire);
+      if ((ok = ready())) break;
+
+      int64_t remaining_ns = -1;
+      if (timeout_ms >= 0) {
+        remaining_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining_ns <= 0) break;
+      }
+      sleep(seq, remaining_ns);
+    }
+    waiters_.fetch_sub(1);
+    return ok;
+  }
+
+  // Call after publishing the change that makes ready() true.
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      seq_.fetch_add(1, std::memory_order_release);
+      wake();
+    }
+  }
+
+private:
+#ifdef __linux__
+  void sleep(uint32_t seq, int64_t timeout_ns) {
+    struct timespec ts = {.tv_sec = time_t(timeout_ns / 1000000000), .tv_nsec = long(timeout_ns % 1000000000)};
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAIT_PRIVATE, seq, timeout_ns >= 0 ? &ts : nullptr, nullptr, 0);
+  }
+  void wake() {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+  }
+#else
+  void sleep(uint32_t seq, int64_t timeout_ns) {
+    if (seq_.load(std::memory_order_acquire) == seq) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(timeout_ns >= 0 ? std::min<int64_t>(timeout_ns, 100000) : 100000));
+    }
+  }
+  void wake() {}
+#endif
+
+  std::atomic<uint32_t> seq_ = 0;
+  std::atomic<uint32_t> waiters_ = 0;
+};
+
+} // namespace queue_detail
+
+template <class T, bool MultiProducer>
+class RingQueue {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+  RingQueue() : RingQueue(DEFAULT_CAPACITY) {}
+  // capacity is rounded up to a power of two
+  explicit RingQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+    slots_ = std::make_unique<Slot[]>(size);
+    for (size_t i = 0; i < size; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ~RingQueue() {
+    std::optional<T> v;
+    while (pop_one(v)) {}
+  }
+  RingQueue(const RingQueue&) = delete;
+  RingQueue& operator=(const RingQueue&) = delete;
+
+  // Non-blocking, returns false if the queue is full. v is left untouched in that case.
+  bool try_push(T &&v) {
+    if (!push_one(v)) return false;
+    not_empty_.notify();
+    return true;
+  }
+  bool try_push(const T &v) { T copy(v); return try_push(std::move(copy)); }
+
+  // Blocks while the queue is full.
+  void push(T v) {
+    while (!push_one(v)) {
+      not_full_.wait([this] { return has_room(); }, -1);
+    }
+    not_empty_.notify();
+  }
+
+  // Moves items [first, last) into the queue, blocking while the queue is full, with one wake-up per batch.
+  template <class It>
+  void push_batch(It first, It last) {
+    while (first != last) {
+      bool pushed = false;
+      for (; first != last && push_one(*first); ++first) pushed = true;
+      if (pushed) not_empty_.notify();
+      if (first != last) not_full_.wait([this] { return has_room(); }, -1);
+    }
+  }
+
+  // Blocks until an element is available.
+  T pop() {
+    std::optional<T> v;
+    not_empty_.wait([&] { return pop_one(v); }, -1);
+    notify_not_full();
+    return std::move(*v);
+  }
+
+  // Waits up to timeout_ms for an element.
+  bool try_pop(T &v, int timeout_ms = 0) {
+    std::optional<T> item;
+    if (!not_empty_.wait([&] { return pop_one(item); }, timeout_ms)) return false;
+    notify_not_full();
+    v = std::move(*item);
+    return true;
+  }
+
+  // Pops up to max_count elements into out, waiting up to timeout_ms for the first one.
+  template <class OutIt>
+  size_t pop_batch(OutIt out, size_t max_count, int timeout_ms = 0) {
+    std::optional<T> v;
+    if (max_count == 0 || !not_empty_.wait([&] { return pop_one(v); }, timeout_ms)) return 0;
+    size_t n = 0;
+    do {
+      *out++ = std::move(*v);
+    } while (++n < max_count && pop_one(v));
+    notify_not_full();
+    return n;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t size() const {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    const size_t head = head_.load(std::memory_order_acquire);
+    return head > tail ? head - tail : 0;
+  }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  // seq == position: free for the producer at that position
+  // seq == position + 1: holds the element for the consumer
+  struct Slot {
+    std::atomic<size_t> seq;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  // Blocked producers wake up once the queue is half empty rather than on every pop.
+  bool has_room() const { return size() <= capacity() / 2; }
+  void notify_not_full() {
+    if (has_room()) not_full_.notify();
+  }
+
+  bool push_one(T &v) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff < 0) return false;  // the slot still holds an element from the previous lap
+      if (diff == 0) {
+        if constexpr (MultiProducer) {
+          if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else {
+          head_.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+      } else {
+        pos = head_.load(std::memory_order_relaxed);  // another producer took this slot
+      }
+    }
+    new (slot->storage) T(std::move(v));
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop_one(std::optional<T> &v) {
+    const size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[pos & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) return false;
+    T *item = std::launder(reinterpret_cast<T *>(slot.storage));
+    v.emplace(std::move(*item));
+    item->~T();
+    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+    tail_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  alignas(queue_detail::CACHE_LINE) std::atomic<size_t> head_ = 0;
+  alignas(queue_detail::CACHE_LINE) std::atomic<size_t> tail_ = 0;
+  alignas(queue_detail::CACHE_LINE) queue_detail::Waiter not_empty_;
+  alignas(queue_detail::CACHE_LINE) queue_detail::Waiter not_full_;
+  size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+template <class T>
+using SpscQueue = RingQueue<T, false>;
+template <class T>
+using MpscQueue = RingQueue<T, true>;
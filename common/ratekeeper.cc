@@ -1,40 +1,82 @@
 #include "common/ratekeeper.h"
 
+#include <time.h>
+
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
 
 #include "common/swaglog.h"
 #include "common/timing.h"
 #include "common/util.h"
+#include "third_party/json11/json11.hpp"
 
 RateKeeper::RateKeeper(const std::string &name, float rate, float print_delay_threshold)
     : name(name),
       print_delay_threshold(std::max(0.f, print_delay_threshold)) {
-  interval = 1 / rate;
-  last_monitor_time = seconds_since_boot();
-  next_frame_time = last_monitor_time + interval;
+  interval_ns = 1e9 / rate;
+  next_frame_ns = nanos_since_boot() + interval_ns;
+}
+
+void RateKeeper::setPrecise(bool enable, uint32_t spin_us) {
+  precise = enable;
+  spin_ns = spin_us * 1000ULL;
 }
 
 bool RateKeeper::keepTime() {
   bool lagged = monitorTime();
-  if (remaining_ > 0) {
+  if (remaining_ <= 0) return lagged;
+
+  if (!precise) {
     util::sleep_for(remaining_ * 1000);
+  } else {
+    if (deadline_ns > spin_ns) {
+      const uint64_t wake_ns = deadline_ns - spin_ns;
+#ifdef __linux__
+      struct timespec ts = {.tv_sec = time_t(wake_ns / 1000000000ULL), .tv_nsec = long(wake_ns % 1000000000ULL)};
+      // nanos_since_boot() is CLOCK_BOOTTIME, so sleep on the same clock
+      while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#else
+      // no clock_nanosleep on macOS, sleep for the remaining time and let the spin absorb the error
+      if (uint64_t now = nanos_since_boot(); wake_ns > now) {
+        std::this_thread::sleep_until(std::chrono::steady_clock::now() + std::chrono::nanoseconds(wake_ns - now));
+      }
+#endif
+    }
+    while (nanos_since_boot() < deadline_ns) {}
   }
+
+  uint64_t now = nanos_since_boot();
+  // the default mode rounds the sleep down to whole milliseconds and may return early
+  jitter_us_.add((now > deadline_ns ? now - deadline_ns : deadline_ns - now) / 1000);
   return lagged;
 }
 
 bool RateKeeper::monitorTime() {
   ++frame_;
-  last_monitor_time = seconds_since_boot();
-  remaining_ = next_frame_time - last_monitor_time;
+  uint64_t now = nanos_since_boot();
+  deadline_ns = next_frame_ns;
+  remaining_ = ((int64_t)deadline_ns - (int64_t)now) / 1e9;
 
-  bool lagged = remaining_ < 0;
+  bool lagged = now > deadline_ns;
   if (lagged) {
+    overrun_us_.add((now - deadline_ns) / 1000);
     if (print_delay_threshold > 0 && remaining_ < -print_delay_threshold) {
       LOGW("%s lagging by %.2f ms", name.c_str(), -remaining_ * 1000);
     }
-    next_frame_time = last_monitor_time + interval;
+    next_frame_ns = now + interval_ns;
   } else {
-    next_frame_time += interval;
+    next_frame_ns += interval_ns;
   }
   return lagged;
 }
+
+std::string RateKeeper::dumpStats() const {
+  return json11::Json(json11::Json::object{
+    {"name", name},
+    {"frames", (double)frame_},
+    {"jitter_us", histogram_json(jitter_us_)},
+    {"overrun_us", histogram_json(overrun_us_)},
+  }).dump();
+}
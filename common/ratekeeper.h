@@ -3,21 +3,36 @@
 #include <cstdint>
 #include <string>
 
+#include "common/histogram.h"
+
 class RateKeeper {
 public:
   RateKeeper(const std::string &name, float rate, float print_delay_threshold = 0);
   ~RateKeeper() {}
   bool keepTime();
   bool monitorTime();
+  // Sleep until the absolute deadline with clock_nanosleep (sleep_until on macOS) instead of
+  // rounding to whole milliseconds, then busy-wait the last spin_us to absorb the wakeup latency.
+  void setPrecise(bool enable, uint32_t spin_us = 0);
   inline uint64_t frame() const { return frame_; }
   inline double remaining() const { return remaining_; }
 
+  // how far from the frame deadline keepTime() returned, early or late
+  inline const Histogram &jitter_us() const { return jitter_us_; }
+  // how far past the deadline monitorTime() was called, for lagging frames only
+  inline const Histogram &overrun_us() const { return overrun_us_; }
+  std::string dumpStats() const;
+
 private:
-  double interval;
-  double next_frame_time;
-  double last_monitor_time;
+  uint64_t interval_ns;
+  uint64_t next_frame_ns;
+  uint64_t deadline_ns = 0;  // deadline of the current frame
   double remaining_ = 0;
   float print_delay_threshold = 0;
+  bool precise = false;
+  uint64_t spin_ns = 0;
   uint64_t frame_ = 0;
   std::string name;
+  Histogram jitter_us_;
+  Histogram overrun_us_;
 };
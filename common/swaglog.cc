@@ -4,10 +4,17 @@
 
 #include "common/swaglog.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include <stdarg.h>
@@ -15,6 +22,79 @@
 #include "common/version.h"
 #include "system/hardware/hw.h"
 
+namespace {
+
+uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
+// how long an error waits for room in a full ring, and a critical message for its ring to be sent
+constexpr auto ERROR_WAIT = std::chrono::milliseconds(10);
+constexpr auto CRITICAL_FLUSH_WAIT = std::chrono::milliseconds(100);
+
+// Everything the swaglog thread needs to encode one log call. filename and func
+// point to __FILE__ and __func__, which are static.
+struct LogRecord {
+  int levelnum;
+  int lineno;
+  const char *filename;
+  const char *func;
+  double created;
+  uint64_t mono_time;
+  uint32_t frame_id;
+  bool timestamp;
+  uint32_t msg_size;  // followed by the message bytes
+};
+
+// Single-producer single-consumer ring of LogRecords. Each logging thread
+// writes into its own ring, the swaglog thread reads from all of them.
+class LogRing {
+public:
+  static constexpr size_t SIZE = 64 * 1024;
+  static constexpr size_t MAX_MSG_SIZE = SIZE / 2;
+
+  // returns false if the ring is full
+  bool write(const LogRecord &r, const char *msg) {
+    const size_t size = sizeof(LogRecord) + r.msg_size;
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head + size - tail_.load(std::memory_order_acquire) > SIZE) return false;
+    copy_in(head, &r, sizeof(r));
+    copy_in(head + sizeof(r), msg, r.msg_size);
+    head_.store(head + size, std::memory_order_release);
+    return true;
+  }
+
+  // returns false if the ring is empty
+  bool read(LogRecord &r, std::string &msg) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    copy_out(tail, &r, sizeof(r));
+    msg.resize(r.msg_size);
+    copy_out(tail + sizeof(r), msg.data(), r.msg_size);
+    tail_.store(tail + sizeof(r) + r.msg_size, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const { return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire); }
+
+  std::atomic<bool> orphaned = false;  // the owning thread exited
+
+private:
+  void copy_in(size_t pos, const void *src, size_t size) {
+    const size_t offset = pos % SIZE, first = std::min(size, SIZE - offset);
+    memcpy(buf_ + offset, src, first);
+    memcpy(buf_, (const char *)src + first, size - first);
+  }
+  void copy_out(size_t pos, void *dst, size_t size) const {
+    const size_t offset = pos % SIZE, first = std::min(size, SIZE - offset);
+    memcpy(dst, buf_ + offset, first);
+    memcpy((char *)dst + first, buf_, size - first);
+  }
+
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+  char buf_[SIZE];
+};
+
+} // namespace
+
 class SwaglogState {
 public:
   SwaglogState() {
@@ -40,7 +120,7 @@ public:
       }
     }
 
-    ctx_j = json11::Json::object{};
+    json11::Json::object ctx_j = json11::Json::object{};
     if (char* dongle_id = getenv("DONGLE_ID")) {
       ctx_j["dongle_id"] = dongle_id;
     }
@@ -59,97 +139,265 @@ public:
     ctx_j["version"] = COMMA_VERSION;
     ctx_j["dirty"] = !getenv("CLEAN");
     ctx_j["device"] = Hardware::get_name();
+    // the context never changes, serialize it once
+    ctx_s = "{\"ctx\":" + json11::Json(ctx_j).dump() + ",";
+
+    thread = std::thread(&SwaglogState::logThread, this);
   }
 
   ~SwaglogState() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_one();
+    drained.notify_all();
+    thread.join();
     zmq_close(sock);
     zmq_ctx_destroy(zctx);
   }
 
-  void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
+  // Called on the logging thread: prints the message if needed and queues it for the swaglog thread.
+  void log(LogRecord &r, const char* msg) {
+    if (r.levelnum >= print_level) {
+      printf("%s: %s\n", r.filename, msg);
+    }
+
+    if (r.msg_size > LogRing::MAX_MSG_SIZE) {
+      thread_local std::string truncated;
+      const std::string marker = "... [truncated " + std::to_string(r.msg_size) + " bytes]";
+      truncated.assign(msg, LogRing::MAX_MSG_SIZE - marker.size());
+      truncated += marker;
+      msg = truncated.c_str();
+      r.msg_size = truncated.size();
+      truncated_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    LogRing *ring = threadRing();
+    bool written = ring->write(r, msg);
+    if (!written && r.levelnum >= CLOUDLOG_ERROR) {
+      // errors are worth a short wait for the swaglog thread to catch up
+      const auto deadline = std::chrono::steady_clock::now() + ERROR_WAIT;
+      while (!written && waitDrained(ring, deadline)) written = ring->write(r, msg);
+    }
+    if (!written) {
+      // the swaglog thread is behind, don't block the caller
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      dropped_total.fetch_add(1, std::memory_order_relaxed);
+    } else if (r.levelnum >= CLOUDLOG_CRITICAL) {
+      // the process is likely about to die, hand the ring to zmq before returning
+      waitDrained(ring, std::chrono::steady_clock::now() + CRITICAL_FLUSH_WAIT);
+    } else if (waiting.load(std::memory_order_acquire)) {
+      wake();
+    }
+  }
+
+  SwaglogStats stats() {
     std::lock_guard lk(lock);
-    if (levelnum >= print_level) {
-      printf("%s: %s\n", filename, msg);
+    return {
+      .dropped = dropped_total.load(std::memory_order_relaxed),
+      .truncated = truncated_count.load(std::memory_order_relaxed),
+      .rings = rings.size(),
+    };
+  }
+
+  int print_level;
+
+private:
+  LogRing *threadRing() {
+    // owned by the ring list, flagged as orphaned when this thread exits
+    struct RingHolder {
+      RingHolder(SwaglogState *s) : ring(std::make_shared<LogRing>()) {
+        std::lock_guard lk(s->lock);
+        s->rings.push_back(ring);
+      }
+      ~RingHolder() { ring->orphaned = true; }
+      std::shared_ptr<LogRing> ring;
+    };
+    thread_local RingHolder holder(this);
+    return holder.ring.get();
+  }
+
+  void wake() {
+    { std::lock_guard lk(lock); }
+    cv.notify_one();
+  }
+
+  // Waits until the swaglog thread has emptied the ring. Returns false on timeout, or once
+  // the swaglog thread is shutting down.
+  bool waitDrained(LogRing *ring, std::chrono::steady_clock::time_point deadline) {
+    wake();
+    std::unique_lock lk(lock);
+    drained.wait_until(lk, deadline, [&]() { return exit || ring->empty(); });
+    return !exit && ring->empty();
+  }
+
+  void logThread() {
+    LogRecord r;
+    std::string msg, log_s;
+    std::vector<std::shared_ptr<LogRing>> active;
+
+    while (true) {
+      {
+        std::unique_lock lk(lock);
+        // drop rings of exited threads once they are drained
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto &ring) {
+          return ring->orphaned && ring->empty();
+        }), rings.end());
+        active = rings;
+      }
+
+      bool idle = true;
+      for (auto &ring : active) {
+        while (ring->read(r, msg)) {
+          encode(r, msg, log_s);
+          zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
+          idle = false;
+        }
+      }
+      if (uint64_t n = dropped.exchange(0, std::memory_order_relaxed)) {
+        msg = "swaglog dropped " + std::to_string(n) + " messages, the log rings were full";
+        r = {
+          .levelnum = CLOUDLOG_WARNING,
+          .lineno = __LINE__,
+          .filename = __FILE__,
+          .func = __func__,
+          .created = seconds_since_epoch(),
+          .mono_time = 0,
+          .frame_id = NO_FRAME_ID,
+          .timestamp = false,
+          .msg_size = (uint32_t)msg.size(),
+        };
+        encode(r, msg, log_s);
+        zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
+        idle = false;
+      }
+      if (!idle) {
+        { std::lock_guard lk(lock); }
+        drained.notify_all();
+        continue;
+      }
+
+      std::unique_lock lk(lock);
+      if (exit) break;
+      waiting.store(true, std::memory_order_release);
+      // a record might have been written before waiting was set, so don't sleep for long
+      cv.wait_for(lk, std::chrono::milliseconds(10));
+      waiting.store(false, std::memory_order_release);
     }
-    zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
+  }
+
+  void encode(const LogRecord &r, const std::string &msg, std::string &log_s) {
+    json11::Json::object log_j = json11::Json::object {
+      {"levelnum", r.levelnum},
+      {"filename", r.filename},
+      {"lineno", r.lineno},
+      {"funcname", r.func},
+      {"created", r.created}
+    };
+    if (!r.timestamp) {
+      log_j["msg"] = msg;
+    } else {
+      json11::Json::object tspt_j = json11::Json::object{
+        {"event", msg},
+        {"time", std::to_string(r.mono_time)}
+      };
+      if (r.frame_id < NO_FRAME_ID) {
+        tspt_j["frame_id"] = std::to_string(r.frame_id);
+      }
+      log_j["msg"] = json11::Json::object{{"timestamp", tspt_j}};
+    }
+
+    // splice the pre-serialized context in front of the other fields
+    log_s.clear();
+    log_s += (char)r.levelnum;
+    log_s += ctx_s;
+    size_t fields_begin = log_s.size();
+    ((json11::Json)log_j).dump(log_s);
+    log_s.erase(fields_begin, 1);  // '{' of the fields object
   }
 
   std::mutex lock;
+  std::condition_variable cv;
+  std::condition_variable drained;  // notified after the swaglog thread sent records
+  std::atomic<bool> waiting = false;
+  std::atomic<uint64_t> dropped = 0;  // records that didn't fit into their ring, not reported yet
+  std::atomic<uint64_t> dropped_total = 0;
+  std::atomic<uint64_t> truncated_count = 0;
+  bool exit = false;
+  std::vector<std::shared_ptr<LogRing>> rings;
+  std::thread thread;
+
   void* zctx = nullptr;
   void* sock = nullptr;
-  int print_level;
-  json11::Json::object ctx_j;
+  std::string ctx_s;
 };
 
 bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
-uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
 
-static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
-                            char* msg_buf, const json11::Json::object &msg_j={}) {
+static SwaglogState &swaglog_state() {
   static SwaglogState s;
+  return s;
+}
 
-  json11::Json::object log_j = json11::Json::object {
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  if (msg_j.empty()) {
-    log_j["msg"] = msg_buf;
-  } else {
-    log_j["msg"] = msg_j;
+SwaglogStats swaglog_stats() {
+  return swaglog_state().stats();
+}
+
+static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
+                            uint32_t frame_id, bool timestamp, const char* fmt, va_list args) {
+  SwaglogState &s = swaglog_state();
+
+  // format on the calling thread, everything else happens on the swaglog thread
+  thread_local char buf[1024];
+  char* msg_buf = buf;
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int ret = vsnprintf(buf, sizeof(buf), fmt, args_copy);
+  va_end(args_copy);
+  if (ret >= (int)sizeof(buf)) {
+    msg_buf = nullptr;
+    ret = vasprintf(&msg_buf, fmt, args);
   }
+  if (ret <= 0 || !msg_buf) return;
 
-  std::string log_s;
-  log_s += (char)levelnum;
-  ((json11::Json)log_j).dump(log_s);
-  s.log(levelnum, filename, lineno, func, msg_buf, log_s);
+  LogRecord r = {
+    .levelnum = levelnum,
+    .lineno = lineno,
+    .filename = filename,
+    .func = func,
+    .created = seconds_since_epoch(),
+    .mono_time = timestamp ? nanos_since_boot() : 0,
+    .frame_id = frame_id,
+    .timestamp = timestamp,
+    .msg_size = (uint32_t)ret,
+  };
+  s.log(r, msg_buf);
 
-  free(msg_buf);
+  if (msg_buf != buf) free(msg_buf);
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
+  cloudlog_common(levelnum, filename, lineno, func, NO_FRAME_ID, false, fmt, args);
   va_end(args);
-  if (ret <= 0 || !msg_buf) return;
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf);
 }
 
-void cloudlog_t_common(int levelnum, const char* filename, int lineno, const char* func,
-                       uint32_t frame_id, const char* fmt, va_list args) {
-  if (!LOG_TIMESTAMPS) return;
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
-  if (ret <= 0 || !msg_buf) return;
-  json11::Json::object tspt_j = json11::Json::object{
-    {"event", msg_buf},
-    {"time", std::to_string(nanos_since_boot())}
-  };
-  if (frame_id < NO_FRAME_ID) {
-    tspt_j["frame_id"] = std::to_string(frame_id);
-  }
-  tspt_j = json11::Json::object{{"timestamp", tspt_j}};
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf, tspt_j);
-}
-
-
 void cloudlog_te(int levelnum, const char* filename, int lineno, const char* func,
                  const char* fmt, ...) {
+  if (!LOG_TIMESTAMPS) return;
   va_list args;
   va_start(args, fmt);
-  cloudlog_t_common(levelnum, filename, lineno, func, NO_FRAME_ID, fmt, args);
+  cloudlog_common(levelnum, filename, lineno, func, NO_FRAME_ID, true, fmt, args);
   va_end(args);
 }
 void cloudlog_te(int levelnum, const char* filename, int lineno, const char* func,
                  uint32_t frame_id, const char* fmt, ...) {
+  if (!LOG_TIMESTAMPS) return;
   va_list args;
   va_start(args, fmt);
-  cloudlog_t_common(levelnum, filename, lineno, func, frame_id, fmt, args);
+  cloudlog_common(levelnum, filename, lineno, func, frame_id, true, fmt, args);
   va_end(args);
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "common/timing.h"
 
 #define CLOUDLOG_DEBUG 10
@@ -25,6 +28,14 @@ void cloudlog_te(int levelnum, const char* filename, int lineno, const char* fun
                  uint32_t frame_id, const char* fmt, ...) SWAG_LOG_CHECK_FMT(6, 7);
 
 
+// Counters of the asynchronous logger
+struct SwaglogStats {
+  uint64_t dropped;    // records dropped because the ring of their thread was full
+  uint64_t truncated;  // messages cut to the maximum record size
+  size_t rings;        // per-thread rings, the ones of exited threads are freed once they are sent
+};
+SwaglogStats swaglog_stats();
+
 #define cloudlog(lvl, fmt, ...) cloudlog_e(lvl, __FILE__, __LINE__, \
                                            __func__, \
                                            fmt, ## __VA_ARGS__)
@@ -0,0 +1,45 @@
+// Compares put() and readAll() of the directory and the log Params backends.
+//
+// usage: bench_params [keys=100]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "common/params.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+int main(int argc, char **argv) {
+  const int num_keys = argc > 1 ? atoi(argv[1]) : 100;
+
+  for (const std::string backend : {"dir", "log"}) {
+    char tmp_path[] = "/tmp/paramsBench_XXXXXX";
+    const std::string param_path = mkdtemp(tmp_path);
+    Params params(param_path);
+    if (backend == "log") params.migrateToLog();
+
+    double start = millis_since_boot();
+    for (int i = 0; i < num_keys; ++i) {
+      if (params.put("Key" + std::to_string(i), util::random_string(64)) != 0) {
+        fprintf(stderr, "put failed\n");
+        return 1;
+      }
+    }
+    const double put_ms = (millis_since_boot() - start) / num_keys;
+
+    start = millis_since_boot();
+    size_t count = 0;
+    for (int i = 0; i < 10; ++i) {
+      count += params.readAll().size();
+    }
+    const double read_all_ms = (millis_since_boot() - start) / 10;
+    if (count != 10 * (size_t)num_keys) {
+      fprintf(stderr, "readAll returned %zu keys\n", count / 10);
+      return 1;
+    }
+
+    printf("%s backend: put() %.3f ms, readAll() of %d keys %.3f ms\n", backend.c_str(), put_ms, num_keys, read_all_ms);
+  }
+  return 0;
+}
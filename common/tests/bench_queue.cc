@@ -0,0 +1,38 @@
+// Compares SafeQueue with the lock-free SpscQueue for one producer and with
+// MpscQueue for several producers, in ns per element pushed and popped.
+//
+// usage: bench_queue [elements per producer=200000] [producers=4]
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/queue.h"
+#include "common/timing.h"
+
+template <class Q>
+static double queue_benchmark(int producers, int count) {
+  Q q;
+  uint64_t start = nanos_since_boot();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < count; ++i) q.push(i);
+    });
+  }
+  for (int i = 0; i < producers * count; ++i) q.pop();
+  for (auto &t : threads) t.join();
+  return (nanos_since_boot() - start) / double(producers * count);
+}
+
+int main(int argc, char **argv) {
+  const int count = argc > 1 ? atoi(argv[1]) : 200000;
+  const int producers = argc > 2 ? atoi(argv[2]) : 4;
+
+  printf("1 producer:  SafeQueue %.1f ns/element, SpscQueue %.1f ns/element\n",
+         queue_benchmark<SafeQueue<int>>(1, count), queue_benchmark<SpscQueue<int>>(1, count));
+  printf("%d producers: SafeQueue %.1f ns/element, MpscQueue %.1f ns/element\n", producers,
+         queue_benchmark<SafeQueue<int>>(producers, count), queue_benchmark<MpscQueue<int>>(producers, count));
+  return 0;
+}
@@ -0,0 +1,39 @@
+// Reports the latency of LOGD calls made from several threads at once.
+//
+// usage: bench_swaglog [threads=8] [messages per thread=10000]
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/swaglog.h"
+#include "common/timing.h"
+
+int main(int argc, char **argv) {
+  const int thread_cnt = argc > 1 ? atoi(argv[1]) : 8;
+  const int thread_msg_cnt = argc > 2 ? atoi(argv[2]) : 10000;
+
+  std::vector<std::vector<uint64_t>> latencies(thread_cnt);
+  std::vector<std::thread> log_threads;
+  for (int i = 0; i < thread_cnt; ++i) {
+    log_threads.push_back(std::thread([&, i]() {
+      latencies[i].reserve(thread_msg_cnt);
+      for (int j = 0; j < thread_msg_cnt; ++j) {
+        uint64_t start = nanos_since_boot();
+        LOGD("thread %d msg %d", i, j);
+        latencies[i].push_back(nanos_since_boot() - start);
+      }
+    }));
+  }
+  for (auto &t : log_threads) t.join();
+
+  std::vector<uint64_t> all;
+  for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  printf("LOGD latency with %d threads: p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, max %" PRIu64 " ns\n", thread_cnt, all[all.size() / 2],
+         all[all.size() * 99 / 100], all.back());
+  return 0;
+}
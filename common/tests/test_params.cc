@@ -1,6 +1,9 @@
+#include <atomic>
+
 #include "catch2/catch.hpp"
 #define private public
 #include "common/params.h"
+#include "common/params_log.h"
 #include "common/util.h"
 
 TEST_CASE("params_nonblocking_put") {
@@ -25,3 +28,154 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_nonblocking_put_coalesces") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  const int num_writes = 100;
+  ParamsWriteStats stats;
+  {
+    Params params(param_path);
+    for (int i = 0; i < num_writes; ++i) {
+      params.putNonBlocking("CarParams", std::to_string(i));
+      params.putBoolNonBlocking("IsMetric", i % 2);
+    }
+    params.future.wait();
+    stats = params.getWriteStats();
+  }
+  // only the latest value of each key is written
+  Params p(param_path);
+  REQUIRE(p.get("CarParams") == std::to_string(num_writes - 1));
+  REQUIRE(p.getBool("IsMetric"));
+
+  REQUIRE(stats.queued == num_writes * 2);
+  REQUIRE(stats.written + stats.coalesced == stats.queued);
+  REQUIRE(stats.coalesced > 0);
+  REQUIRE(stats.batches <= stats.written);
+}
+
+TEST_CASE("params_putMany_writes_the_other_values_after_a_failure") {
+  char tmp_path[] = "/tmp/paramsPutMany_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+
+  // a value can't be moved over a non-empty directory
+  REQUIRE(util::create_directories(params.getParamPath("AaBlocked") + "/x", 0775));
+  REQUIRE(params.putMany({{"AaBlocked", "1"}, {"CarParams", "1"}, {"IsMetric", "1"}}) != 0);
+  REQUIRE(params.get("CarParams") == "1");
+  REQUIRE(params.get("IsMetric") == "1");
+}
+
+TEST_CASE("params_cached_get") {
+  char tmp_path[] = "/tmp/paramsCache_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params cached(param_path, true);
+  Params writer(param_path);
+
+  writer.put("CarParams", "1");
+  REQUIRE(cached.get("CarParams") == "1");
+
+  // own writes are visible immediately
+  cached.put("CarParams", "2");
+  REQUIRE(cached.get("CarParams") == "2");
+
+  // writes from elsewhere invalidate the entry through inotify
+  writer.put("CarParams", "3");
+  for (int i = 0; i < 100 && cached.get("CarParams") != "3"; ++i) {
+    util::sleep_for(10);
+  }
+  REQUIRE(cached.get("CarParams") == "3");
+
+  writer.remove("CarParams");
+  for (int i = 0; i < 100 && !cached.get("CarParams").empty(); ++i) {
+    util::sleep_for(10);
+  }
+  REQUIRE(cached.get("CarParams").empty());
+}
+
+TEST_CASE("params_blocking_get_wakes_on_write") {
+  char tmp_path[] = "/tmp/paramsBlocking_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+
+  std::atomic<bool> writing = false;
+  auto writer = std::async(std::launch::async, [&]() {
+    util::sleep_for(50);
+    writing = true;
+    Params(param_path).put("CarParams", "1");
+  });
+  auto reader = std::async(std::launch::async, [&]() { return params.get("CarParams", true); });
+  // generous timeout, so a slow machine doesn't fail the test
+  REQUIRE(reader.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+  // it returned because of the put
+  REQUIRE(writing);
+  REQUIRE(reader.get() == "1");
+  writer.wait();
+}
+
+TEST_CASE("params_log_backend") {
+  char tmp_path[] = "/tmp/paramsLog_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+
+  // values of the directory backend are migrated into a new log
+  Params params(param_path);
+  params.put("CarParams", "dir");
+  REQUIRE_FALSE(params.log);
+  params.migrateToLog();
+  REQUIRE(params.log);
+  REQUIRE(params.get("CarParams") == "dir");
+  const std::string log_path = params.getLogPath();
+
+  SECTION("new Params share the log") {
+    Params other(param_path);
+    REQUIRE(other.log == params.log);
+    REQUIRE(other.put("CarParams", "1") == 0);
+    REQUIRE(params.get("CarParams") == "1");
+  }
+  SECTION("cached") {
+    Params cached(param_path, true);
+    REQUIRE(cached.cache);
+    REQUIRE(cached.get("CarParams") == "dir");
+
+    // own writes are visible immediately
+    REQUIRE(cached.put("CarParams", "1") == 0);
+    REQUIRE(cached.get("CarParams") == "1");
+
+    // appends from elsewhere invalidate the entries through inotify
+    ParamsLog writer(log_path, param_path + "/.lock");
+    REQUIRE(writer.write({{"CarParams", "2"}}) == 0);
+    for (int i = 0; i < 100 && cached.get("CarParams") != "2"; ++i) {
+      util::sleep_for(10);
+    }
+    REQUIRE(cached.get("CarParams") == "2");
+  }
+
+  SECTION("putMany") {
+    REQUIRE(params.putMany({{"CarParams", "1"}, {"IsMetric", "1"}}) == 0);
+    REQUIRE(params.readAll() == std::map<std::string, std::string>{{"CarParams", "1"}, {"IsMetric", "1"}});
+    REQUIRE(params.remove("IsMetric") == 0);
+    REQUIRE(params.get("IsMetric").empty());
+  }
+  SECTION("torn record is ignored and overwritten") {
+    REQUIRE(params.put("CarParams", "1") == 0);
+    std::string contents = util::read_file(log_path);
+    REQUIRE(params.put("CarParams", "2") == 0);
+    // simulate a crash in the middle of the last append
+    std::string torn = util::read_file(log_path);
+    torn.resize(contents.size() + (torn.size() - contents.size()) / 2);
+    REQUIRE(util::write_file(log_path.c_str(), torn.data(), torn.size(), O_WRONLY | O_TRUNC) == 0);
+
+    ParamsLog reader(log_path, param_path + "/.lock");
+    REQUIRE(reader.get("CarParams") == "1");
+    REQUIRE(reader.write({{"IsMetric", "1"}}) == 0);
+    REQUIRE(reader.readAll() == std::map<std::string, std::string>{{"CarParams", "1"}, {"IsMetric", "1"}});
+  }
+  SECTION("compaction") {
+    const std::string value(64 * 1024, 'x');
+    for (int i = 0; i < 20; ++i) {
+      REQUIRE(params.put("CarParams", value + std::to_string(i)) == 0);
+    }
+    REQUIRE(util::read_file(log_path).size() < 4 * value.size());
+    REQUIRE(params.get("CarParams") == value + "19");
+  }
+}
@@ -0,0 +1,65 @@
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/queue.h"
+
+TEST_CASE("SpscQueue") {
+  SpscQueue<std::unique_ptr<int>> q(3);
+  REQUIRE(q.capacity() == 4);
+  REQUIRE(q.empty());
+
+  for (int i = 0; i < 4; ++i) REQUIRE(q.try_push(std::make_unique<int>(i)));
+  auto extra = std::make_unique<int>(4);
+  REQUIRE_FALSE(q.try_push(std::move(extra)));
+  REQUIRE(extra);  // not moved from when the push fails
+  REQUIRE(q.size() == 4);
+
+  std::unique_ptr<int> v;
+  REQUIRE(q.try_pop(v));
+  REQUIRE(*v == 0);
+  REQUIRE(q.try_push(std::move(extra)));
+
+  std::vector<std::unique_ptr<int>> out;
+  REQUIRE(q.pop_batch(std::back_inserter(out), 10) == 4);
+  for (int i = 0; i < 4; ++i) REQUIRE(*out[i] == i + 1);
+  REQUIRE_FALSE(q.try_pop(v, 10));
+}
+
+TEMPLATE_TEST_CASE("RingQueue delivers every element", "", SpscQueue<int>, MpscQueue<int>) {
+  const int producers = std::is_same_v<TestType, SpscQueue<int>> ? 1 : 4;
+  const int count = 100000;
+  TestType q(64);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&, p]() {
+      std::vector<int> batch;
+      for (int i = 0; i < count; ++i) {
+        batch.push_back(p * count + i);
+        if (batch.size() == 16 || i == count - 1) {
+          q.push_batch(batch.begin(), batch.end());
+          batch.clear();
+        }
+      }
+    });
+  }
+
+  std::vector<int> last(producers, -1);
+  std::vector<int> out;
+  for (int received = 0; received < producers * count;) {
+    out.clear();
+    size_t n = q.pop_batch(std::back_inserter(out), 32, 1000);
+    REQUIRE(n > 0);
+    for (int v : out) {
+      // elements of one producer arrive in order
+      REQUIRE(v % count == last[v / count] + 1);
+      last[v / count] = v % count;
+    }
+    received += n;
+  }
+  for (auto &t : threads) t.join();
+  REQUIRE(q.empty());
+}
@@ -0,0 +1,34 @@
+#include <unistd.h>
+
+#include "catch2/catch.hpp"
+#include "common/ratekeeper.h"
+#include "common/timing.h"
+
+TEST_CASE("RateKeeper") {
+  const bool precise = GENERATE(false, true);
+  const int frames = 50;
+  RateKeeper rk("test", 100);
+  rk.setPrecise(precise, precise ? 100 : 0);
+
+  uint64_t start = nanos_since_boot();
+  for (int i = 0; i < frames; ++i) rk.keepTime();
+  double elapsed_ms = (nanos_since_boot() - start) / 1e6;
+
+  INFO((precise ? "precise" : "default") << ": " << rk.dumpStats());
+  REQUIRE(rk.frame() == frames);
+  REQUIRE(rk.jitter_us().count() + rk.overrun_us().count() == frames);
+  // keepTime() never returns much before the deadline, the default mode rounds the
+  // sleep down to whole milliseconds. the upper bound only catches gross errors, a
+  // loaded machine can be late by a lot
+  REQUIRE(elapsed_ms >= (frames - 1) * 10.0 - frames);
+  REQUIRE(elapsed_ms < frames * 10.0 * 4);
+}
+
+TEST_CASE("RateKeeper records overruns") {
+  RateKeeper rk("test", 100);
+  rk.keepTime();
+  usleep(25 * 1000);
+  REQUIRE(rk.keepTime());
+  REQUIRE(rk.overrun_us().count() == 1);
+  REQUIRE(rk.overrun_us().max() >= 10 * 1000);
+}
@@ -1,6 +1,9 @@
 #include <zmq.h>
 
+#include <functional>
+#include <future>
 #include <iostream>
+#include <thread>
 
 #include "catch2/catch.hpp"
 #include "common/swaglog.h"
@@ -86,3 +89,108 @@ TEST_CASE("swaglog") {
 
   recv_log(thread_cnt, thread_msg_cnt);
 }
+
+// Receives the records sent after it was created
+class LogReceiver {
+public:
+  LogReceiver() : zctx(zmq_ctx_new()), sock(zmq_socket(zctx, ZMQ_PULL)) {
+    zmq_bind(sock, Path::swaglog_ipc().c_str());
+    // give the swaglog socket time to reconnect
+    util::sleep_for(100);
+  }
+  ~LogReceiver() {
+    zmq_close(sock);
+    zmq_ctx_destroy(zctx);
+  }
+
+  // Returns the messages of the records received until done returns true or the timeout expires
+  std::vector<json11::Json> recv(const std::function<bool(const json11::Json &msg)> &done, int timeout_ms = 2000) {
+    std::vector<json11::Json> msgs;
+    std::vector<char> buf(128 * 1024);
+    for (auto start = std::chrono::steady_clock::now(); std::chrono::steady_clock::now() < start + std::chrono::milliseconds(timeout_ms);) {
+      int size = zmq_recv(sock, buf.data(), buf.size(), ZMQ_DONTWAIT);
+      if (size <= 0) {
+        util::sleep_for(1);
+        continue;
+      }
+      std::string err;
+      auto msg = json11::Json::parse(std::string(buf.data() + 1, std::min<size_t>(size, buf.size()) - 1), err);
+      REQUIRE(err.empty());
+      msgs.push_back(msg);
+      if (done(msg)) break;
+    }
+    return msgs;
+  }
+
+private:
+  void *zctx, *sock;
+};
+
+TEST_CASE("swaglog truncates long messages") {
+  LogReceiver receiver;
+  const uint64_t truncated = swaglog_stats().truncated;
+  const std::string long_msg(40 * 1024, 'x');
+  LOGD("%s", long_msg.c_str());
+  REQUIRE(swaglog_stats().truncated == truncated + 1);
+
+  auto msgs = receiver.recv([](auto &msg) { return util::starts_with(msg["msg"].string_value(), "xxx"); });
+  REQUIRE(!msgs.empty());
+  const std::string msg = msgs.back()["msg"].string_value();
+  INFO(msg.substr(msg.size() - std::min<size_t>(msg.size(), 64)));
+  REQUIRE(msg.size() < long_msg.size());
+  REQUIRE(util::ends_with(msg, "xxx... [truncated 40960 bytes]"));
+}
+
+TEST_CASE("swaglog drops records when a ring is full") {
+  LogReceiver receiver;
+  const uint64_t dropped = swaglog_stats().dropped;
+  // the ring of this thread has room for a few of them, and they take longer to send than to log
+  const std::string msg(16 * 1024, 'y');
+  for (int i = 0; i < 1000; ++i) {
+    LOGD("%s", msg.c_str());
+  }
+  const uint64_t num_dropped = swaglog_stats().dropped - dropped;
+  REQUIRE(num_dropped > 0);
+  REQUIRE(num_dropped < 1000);
+
+  // the swaglog thread reports the drops
+  uint64_t reported = 0;
+  receiver.recv([&](auto &msg) {
+    const std::string text = msg["msg"].string_value();
+    if (msg["levelnum"].int_value() == CLOUDLOG_WARNING && util::starts_with(text, "swaglog dropped ")) {
+      reported += std::stoull(text.substr(strlen("swaglog dropped ")));
+    }
+    return reported >= num_dropped;
+  });
+  REQUIRE(reported == num_dropped);
+}
+
+TEST_CASE("swaglog frees the rings of exited threads") {
+  LOGD("the ring of the main thread");
+  const size_t rings = swaglog_stats().rings;
+  const int thread_cnt = 5;
+
+  std::promise<void> checked;
+  std::shared_future<void> checked_future = checked.get_future();
+  std::vector<std::future<void>> logged;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < thread_cnt; ++i) {
+    std::promise<void> p;
+    logged.push_back(p.get_future());
+    threads.emplace_back([i, p = std::move(p), checked_future]() mutable {
+      LOGD("exiting thread %d", i);
+      p.set_value();
+      checked_future.wait();
+    });
+  }
+  for (auto &f : logged) f.wait();
+  REQUIRE(swaglog_stats().rings == rings + thread_cnt);
+  checked.set_value();
+  for (auto &t : threads) t.join();
+
+  // the rings are freed once their records are sent
+  for (int i = 0; i < 200 && swaglog_stats().rings != rings; ++i) {
+    util::sleep_for(10);
+  }
+  REQUIRE(swaglog_stats().rings == rings);
+}
@@ -127,7 +127,7 @@ void can_recv(std::vector<Panda *> &pandas, PubMaster *pm) {
       canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
       canData[i].setSrc(raw_can_data[i].src);
     }
-    pm->send("can", msg);
+    pm->send(cereal::Event::CAN, msg);
   }
 }
 
@@ -381,17 +381,17 @@ void process_peripheral_state(Panda *panda, PubMaster *pm, bool no_fan_control)
 
   {
     sm.update(0);
-    if (sm.updated("deviceState") && !no_fan_control) {
+    if (sm.updated(cereal::Event::DEVICE_STATE) && !no_fan_control) {
       // Fan speed
-      uint16_t fan_speed = sm["deviceState"].getDeviceState().getFanSpeedPercentDesired();
+      uint16_t fan_speed = sm[cereal::Event::DEVICE_STATE].getDeviceState().getFanSpeedPercentDesired();
       if (fan_speed != prev_fan_speed || sm.frame % 100 == 0) {
         panda->set_fan_speed(fan_speed);
         prev_fan_speed = fan_speed;
       }
     }
 
-    if (sm.updated("driverCameraState")) {
-      auto event = sm["driverCameraState"];
+    if (sm.updated(cereal::Event::DRIVER_CAMERA_STATE)) {
+      auto event = sm[cereal::Event::DRIVER_CAMERA_STATE];
       int cur_integ_lines = event.getDriverCameraState().getIntegLines();
 
       // reset the filter when camerad restarts
@@ -438,6 +438,7 @@ void pandad_run(std::vector<Panda *> &pandas) {
 
   Params params;
   RateKeeper rk("pandad", 100);
+  rk.setPrecise(true);
   SubMaster sm({"selfdriveState"});
   PubMaster pm({"can", "pandaStates", "peripheralState"});
   PandaSafety panda_safety(pandas);
@@ -457,7 +458,7 @@ void pandad_run(std::vector<Panda *> &pandas) {
     // Process panda state at 10 Hz
     if (rk.frame() % 10 == 0) {
       sm.update(0);
-      engaged = sm.allAliveAndValid({"selfdriveState"}) && sm["selfdriveState"].getSelfdriveState().getEnabled();
+      engaged = sm.allAliveAndValid({"selfdriveState"}) && sm[cereal::Event::SELFDRIVE_STATE].getSelfdriveState().getEnabled();
       is_onroad = params.getBool("IsOnroad");
       process_panda_state(pandas, &pm, engaged, is_onroad, spoofing_started);
       panda_safety.configureSafetyMode(is_onroad);
@@ -0,0 +1,72 @@
+#include "system/loggerd/audio_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void s16_to_float(const int16_t *src, float *dst, size_t count) {
+  constexpr float normalizer = 1.0f / 32768.0f;
+  size_t i = 0;
+#if defined(__ARM_NEON)
+  const float32x4_t scale = vdupq_n_f32(normalizer);
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t s = vld1q_s16(src + i);
+    vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))), scale));
+    vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))), scale));
+  }
+#elif defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(normalizer);
+  for (; i + 8 <= count; i += 8) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    // interleave each sample with itself, the arithmetic shift sign extends it to 32 bits
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = src[i] * normalizer;
+  }
+}
+
+void AudioBuffer::resize(size_t capacity) {
+  buffer_.assign(capacity, 0.0f);
+  read_ = count_ = 0;
+}
+
+size_t AudioBuffer::write(const int16_t *samples, size_t count) {
+  const size_t capacity = buffer_.size();
+  size_t dropped = 0;
+  if (count_ + count > capacity) {
+    dropped = count_ + count - capacity;
+    const size_t buffered_drop = std::min(dropped, count_);
+    read_ = (read_ + buffered_drop) % capacity;
+    count_ -= buffered_drop;
+    samples += dropped - buffered_drop;
+    count -= dropped - buffered_drop;
+  }
+
+  const size_t write = (read_ + count_) % capacity;
+  const size_t first = std::min(count, capacity - write);
+  s16_to_float(samples, buffer_.data() + write, first);
+  s16_to_float(samples + first, buffer_.data(), count - first);
+  count_ += count;
+  return dropped;
+}
+
+void AudioBuffer::read(float *dst, size_t count) {
+  assert(count <= count_);
+  const size_t capacity = buffer_.size();
+  const size_t first = std::min(count, capacity - read_);
+  memcpy(dst, buffer_.data() + read_, first * sizeof(float));
+  memcpy(dst + first, buffer_.data(), (count - first) * sizeof(float));
+  read_ = (read_ + count) % capacity;
+  count_ -= count;
+}
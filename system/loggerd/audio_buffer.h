@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Converts s16 samples to floats in [-1, 1)
+void s16_to_float(const int16_t *src, float *dst, size_t count);
+
+// Fixed ring of float samples waiting to be encoded. Not thread safe.
+class AudioBuffer {
+public:
+  void resize(size_t capacity);
+  size_t capacity() const { return buffer_.size(); }
+  size_t size() const { return count_; }
+
+  // Converts the samples into the ring. If it is full, the oldest samples are dropped,
+  // the buffered ones first, then the start of the new ones. Returns the number dropped.
+  size_t write(const int16_t *samples, size_t count);
+  // Moves the oldest count samples to dst, count must be at most size()
+  void read(float *dst, size_t count);
+
+private:
+  std::vector<float> buffer_;
+  size_t read_ = 0;  // index of the oldest sample
+  size_t count_ = 0;
+};
@@ -11,7 +11,7 @@ VideoEncoder::VideoEncoder(const EncoderInfo &encoder_info, int in_width, int in
 
 void VideoEncoder::publisher_publish(int segment_num, uint32_t idx, VisionIpcBufExtra &extra,
                                      unsigned int flags, kj::ArrayPtr<capnp::byte> header, kj::ArrayPtr<capnp::byte> dat) {
-  MessageBuilder msg;
+  MessageBuilder &msg = msg_builder.reset();
   auto event = msg.initEvent(true);
   auto edat = (event.*(encoder_info.init_encode_data_func))();
   auto edata = edat.initIdx();
@@ -32,11 +32,5 @@ void VideoEncoder::publisher_publish(int segment_num, uint32_t idx, VisionIpcBuf
   edat.setHeight(out_height);
   if (flags & V4L2_BUF_FLAG_KEYFRAME) edat.setHeader(header);
 
-  uint32_t bytes_size = capnp::computeSerializedSizeInWords(msg) * sizeof(capnp::word);
-  if (msg_cache.size() < bytes_size) {
-    msg_cache.resize(bytes_size);
-  }
-  kj::ArrayOutputStream output_stream(kj::ArrayPtr<capnp::byte>(msg_cache.data(), bytes_size));
-  capnp::writeMessage(output_stream, msg);
-  pm->send(encoder_info.publish_name, msg_cache.data(), bytes_size);
+  pm->send(encoder_info.publish_name, msg);
 }
@@ -2,6 +2,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,11 +13,13 @@ extern "C" {
 }
 
 #include "system/loggerd/encoder/encoder.h"
+#include "system/loggerd/encoder/frame_converter.h"
 #include "system/loggerd/loggerd.h"
 
 class FfmpegEncoder : public VideoEncoder {
 public:
-  FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height);
+  // With a shared converter, its owner converts every frame before passing it to encode_frame().
+  FfmpegEncoder(const EncoderInfo &encoder_info, int in_width, int in_height, std::shared_ptr<FrameConverter> converter = nullptr);
   ~FfmpegEncoder();
   int encode_frame(VisionBuf* buf, VisionIpcBufExtra *extra);
   void encoder_open();
@@ -29,6 +32,6 @@ private:
 
   AVCodecContext *codec_ctx;
   AVFrame *frame = NULL;
-  std::vector<uint8_t> convert_buf;
-  std::vector<uint8_t> downscale_buf;
+  std::shared_ptr<FrameConverter> converter;
+  bool owns_converter = false;
 };
@@ -0,0 +1,55 @@
+#include "system/loggerd/encoder/frame_converter.h"
+
+#include <cassert>
+
+#include "third_party/libyuv/include/libyuv.h"
+
+static I420View view(const uint8_t *buf, int width, int height) {
+  const uint8_t *u = buf + width * height;
+  return {.y = buf, .u = u, .v = u + (width / 2) * (height / 2), .width = width, .height = height};
+}
+
+FrameConverter::FrameConverter(int in_width, int in_height) : in_width(in_width), in_height(in_height) {
+  addOutputSize(in_width, in_height);
+}
+
+void FrameConverter::addOutputSize(int width, int height) {
+  for (auto &out : outputs) {
+    if (out.width == width && out.height == height) return;
+  }
+  outputs.push_back({.width = width, .height = height, .buf = std::vector<uint8_t>(width * height * 3 / 2)});
+}
+
+void FrameConverter::convert(const VisionBuf *buf) {
+  assert(buf->width == in_width);
+  assert(buf->height == in_height);
+
+  const I420View full = view(outputs[0].buf.data(), in_width, in_height);
+  libyuv::NV12ToI420(buf->y, buf->stride,
+                     buf->uv, buf->stride,
+                     (uint8_t *)full.y, in_width,
+                     (uint8_t *)full.u, in_width/2,
+                     (uint8_t *)full.v, in_width/2,
+                     in_width, in_height);
+
+  for (size_t i = 1; i < outputs.size(); ++i) {
+    const I420View out = view(outputs[i].buf.data(), outputs[i].width, outputs[i].height);
+    libyuv::I420Scale(full.y, in_width,
+                      full.u, in_width/2,
+                      full.v, in_width/2,
+                      in_width, in_height,
+                      (uint8_t *)out.y, out.width,
+                      (uint8_t *)out.u, out.width/2,
+                      (uint8_t *)out.v, out.width/2,
+                      out.width, out.height,
+                      libyuv::kFilterNone);
+  }
+}
+
+I420View FrameConverter::get(int width, int height) const {
+  for (auto &out : outputs) {
+    if (out.width == width && out.height == height) return view(out.buf.data(), width, height);
+  }
+  assert(false);
+  return {};
+}
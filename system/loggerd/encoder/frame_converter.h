@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "msgq/visionipc/visionbuf.h"
+
+// Read-only I420 image with tightly packed planes
+struct I420View {
+  const uint8_t *y, *u, *v;
+  int width, height;
+};
+
+// Converts each NV12 camera frame to I420 once and scales it to every size the
+// camera's encoders asked for, instead of every encoder converting on its own.
+class FrameConverter {
+public:
+  FrameConverter(int in_width, int in_height);
+  // must be called before the first convert()
+  void addOutputSize(int width, int height);
+  void convert(const VisionBuf *buf);
+  // valid until the next convert()
+  I420View get(int width, int height) const;
+
+private:
+  struct Output {
+    int width, height;
+    std::vector<uint8_t> buf;
+  };
+  const int in_width, in_height;
+  std::vector<Output> outputs;  // the first one is the full size
+};
@@ -3,69 +3,42 @@
 #include <cassert>
 #include <cstring>
 
-JpegEncoder::JpegEncoder(const std::string &pusblish_name, int width, int height)
-    : publish_name(pusblish_name), thumbnail_width(width), thumbnail_height(height) {
-  yuv_buffer.resize((thumbnail_width * ((thumbnail_height + 15) & ~15) * 3) / 2);
-  pm = std::make_unique<PubMaster>(std::vector{pusblish_name.c_str()});
-}
-
-JpegEncoder::~JpegEncoder() {
-  if (out_buffer) {
-    free(out_buffer);
-  }
-}
-
-void JpegEncoder::pushThumbnail(VisionBuf *buf, const VisionIpcBufExtra &extra) {
-  generateThumbnail(buf->y, buf->uv, buf->width, buf->height, buf->stride);
-
-  MessageBuilder msg;
-  auto thumbnaild = msg.initEvent().initThumbnail();
-  thumbnaild.setFrameId(extra.frame_id);
-  thumbnaild.setTimestampEof(extra.timestamp_eof);
-  thumbnaild.setThumbnail({out_buffer, out_size});
+#include "third_party/libyuv/include/libyuv.h"
 
-  pm->send(publish_name.c_str(), msg);
-}
+static int align(int v, int n) { return (v + n - 1) & ~(n - 1); }
 
-void JpegEncoder::generateThumbnail(const uint8_t *y_addr, const uint8_t *uv_addr, int width, int height, int stride) {
-  int downscale = width / thumbnail_width;
-  assert(downscale * thumbnail_height == height);
-
-  // make the buffer big enough. jpeg_write_raw_data requires 16-pixels aligned height to be used.
-  uint8_t *y_plane = yuv_buffer.data();
-  uint8_t *u_plane = y_plane + thumbnail_width * thumbnail_height;
-  uint8_t *v_plane = u_plane + (thumbnail_width * thumbnail_height) / 4;
-  {
-    // subsampled conversion from nv12 to yuv
-    for (int hy = 0; hy < thumbnail_height / 2; hy++) {
-      for (int hx = 0; hx < thumbnail_width / 2; hx++) {
-        int ix = hx * downscale + (downscale - 1) / 2;
-        int iy = hy * downscale + (downscale - 1) / 2;
-        y_plane[(hy * 2 + 0) * thumbnail_width + (hx * 2 + 0)] = y_addr[(iy * 2 + 0) * stride + ix * 2 + 0];
-        y_plane[(hy * 2 + 0) * thumbnail_width + (hx * 2 + 1)] = y_addr[(iy * 2 + 0) * stride + ix * 2 + 1];
-        y_plane[(hy * 2 + 1) * thumbnail_width + (hx * 2 + 0)] = y_addr[(iy * 2 + 1) * stride + ix * 2 + 0];
-        y_plane[(hy * 2 + 1) * thumbnail_width + (hx * 2 + 1)] = y_addr[(iy * 2 + 1) * stride + ix * 2 + 1];
-        u_plane[hy * thumbnail_width / 2 + hx] = uv_addr[iy * stride + ix * 2 + 0];
-        v_plane[hy * thumbnail_width / 2 + hx] = uv_addr[iy * stride + ix * 2 + 1];
-      }
-    }
+// fill the padding right and below the image with its edge pixels. padding with
+// anything else rings into the visible part of the edge blocks.
+static void pad_plane(uint8_t *plane, int stride, int width, int height, int padded_height) {
+  for (int y = 0; y < height; ++y) {
+    uint8_t *row = plane + y * stride;
+    memset(row + width, row[width - 1], stride - width);
+  }
+  for (int y = height; y < padded_height; ++y) {
+    memcpy(plane + y * stride, plane + (height - 1) * stride, stride);
   }
-
-  compressToJpeg(y_plane, u_plane, v_plane);
 }
 
-void JpegEncoder::compressToJpeg(uint8_t *y_plane, uint8_t *u_plane, uint8_t *v_plane) {
-  struct jpeg_compress_struct cinfo;
-  struct jpeg_error_mgr jerr;
+JpegEncoder::JpegEncoder(const std::string &pusblish_name, int width, int height)
+    : publish_name(pusblish_name), thumbnail_width(width), thumbnail_height(height) {
+  // jpeg_write_raw_data reads whole 16x16 MCUs, so pad the planes to the MCU grid
+  y_stride = align(thumbnail_width, 16);
+  uv_stride = y_stride / 2;
+  const int padded_height = align(thumbnail_height, 16);
+  y_plane.resize(y_stride * padded_height);
+  u_plane.resize(uv_stride * padded_height / 2);
+  v_plane.resize(uv_stride * padded_height / 2);
+  uv_plane.resize(uv_stride * padded_height / 2);
+  pm = std::make_unique<PubMaster>(std::vector{pusblish_name.c_str()});
+
+  // the compressor and its settings are kept for every thumbnail
   cinfo.err = jpeg_std_error(&jerr);
   jpeg_create_compress(&cinfo);
-
-  if (out_buffer) {
-    free(out_buffer);
-    out_buffer = nullptr;
-    out_size = 0;
-  }
-  jpeg_mem_dest(&cinfo, &out_buffer, &out_size);
+  cinfo.client_data = this;
+  dest.init_destination = initDestination;
+  dest.empty_output_buffer = emptyOutputBuffer;
+  dest.term_destination = termDestination;
+  cinfo.dest = &dest;
 
   cinfo.image_width = thumbnail_width;
   cinfo.image_height = thumbnail_height;
@@ -81,8 +54,56 @@ void JpegEncoder::compressToJpeg(uint8_t *y_plane, uint8_t *u_plane, uint8_t *v_
   cinfo.comp_info[2].h_samp_factor = 1;  // V
   cinfo.comp_info[2].v_samp_factor = 1;
   cinfo.raw_data_in = TRUE;
-
   jpeg_set_quality(&cinfo, 50, TRUE);
+}
+
+JpegEncoder::~JpegEncoder() {
+  jpeg_destroy_compress(&cinfo);
+}
+
+void JpegEncoder::pushThumbnail(VisionBuf *buf, const VisionIpcBufExtra &extra) {
+  MessageBuilder msg;
+  auto thumbnaild = msg.initEvent().initThumbnail();
+  thumbnaild.setFrameId(extra.frame_id);
+  thumbnaild.setTimestampEof(extra.timestamp_eof);
+  thumbnaild.setThumbnail(getThumbnail(buf, extra.frame_id));
+
+  pm->send(publish_name.c_str(), msg);
+}
+
+kj::ArrayPtr<const uint8_t> JpegEncoder::getThumbnail(const VisionBuf *buf, uint32_t frame_id) {
+  if (!has_thumbnail || frame_id != thumbnail_frame_id) {
+    generateThumbnail(buf->y, buf->uv, buf->width, buf->height, buf->stride);
+    compressToJpeg();
+    has_thumbnail = true;
+    thumbnail_frame_id = frame_id;
+  }
+  return {out_buffer.data(), out_size};
+}
+
+void JpegEncoder::generateThumbnail(const uint8_t *y_addr, const uint8_t *uv_addr, int width, int height, int stride) {
+  // decimate nv12 to planar yuv at any scale. each uv pair is scaled as one 16 bit
+  // sample so it's never blended with its neighbour, and then split into u and v.
+  const int uv_width = (thumbnail_width + 1) / 2;
+  const int uv_height = (thumbnail_height + 1) / 2;
+  libyuv::ScalePlane(y_addr, stride, width, height,
+                     y_plane.data(), y_stride, thumbnail_width, thumbnail_height,
+                     libyuv::kFilterNone);
+  libyuv::ScalePlane_16((const uint16_t *)uv_addr, stride / 2, width / 2, height / 2,
+                        uv_plane.data(), uv_stride, uv_width, uv_height,
+                        libyuv::kFilterNone);
+  libyuv::SplitUVPlane((const uint8_t *)uv_plane.data(), uv_stride * 2,
+                       u_plane.data(), uv_stride,
+                       v_plane.data(), uv_stride,
+                       uv_width, uv_height);
+
+  const int padded_height = align(thumbnail_height, 16);
+  pad_plane(y_plane.data(), y_stride, thumbnail_width, thumbnail_height, padded_height);
+  pad_plane(u_plane.data(), uv_stride, uv_width, uv_height, padded_height / 2);
+  pad_plane(v_plane.data(), uv_stride, uv_width, uv_height, padded_height / 2);
+}
+
+void JpegEncoder::compressToJpeg() {
   jpeg_start_compress(&cinfo, TRUE);
 
   JSAMPROW y[16], u[8], v[8];
@@ -90,16 +111,41 @@ void JpegEncoder::compressToJpeg(uint8_t *y_plane, uint8_t *u_plane, uint8_t *v_
 
   for (int line = 0; line < cinfo.image_height; line += 16) {
     for (int i = 0; i < 16; ++i) {
-      y[i] = y_plane + (line + i) * cinfo.image_width;
+      y[i] = y_plane.data() + (line + i) * y_stride;
       if (i % 2 == 0) {
-        int offset = (cinfo.image_width / 2) * ((i + line) / 2);
-        u[i / 2] = u_plane + offset;
-        v[i / 2] = v_plane + offset;
+        int offset = uv_stride * ((i + line) / 2);
+        u[i / 2] = u_plane.data() + offset;
+        v[i / 2] = v_plane.data() + offset;
       }
     }
     jpeg_write_raw_data(&cinfo, planes, 16);
   }
 
   jpeg_finish_compress(&cinfo);
-  jpeg_destroy_compress(&cinfo);
+}
+
+// memory destination that keeps its buffer between thumbnails and only grows it
+
+void JpegEncoder::initDestination(j_compress_ptr cinfo) {
+  JpegEncoder *e = (JpegEncoder *)cinfo->client_data;
+  if (e->out_buffer.empty()) {
+    e->out_buffer.resize(64 * 1024);
+  }
+  e->dest.next_output_byte = e->out_buffer.data();
+  e->dest.free_in_buffer = e->out_buffer.size();
+}
+
+boolean JpegEncoder::emptyOutputBuffer(j_compress_ptr cinfo) {
+  // called when the buffer is full
+  JpegEncoder *e = (JpegEncoder *)cinfo->client_data;
+  const size_t used = e->out_buffer.size();
+  e->out_buffer.resize(used * 2);
+  e->dest.next_output_byte = e->out_buffer.data() + used;
+  e->dest.free_in_buffer = e->out_buffer.size() - used;
+  return TRUE;
+}
+
+void JpegEncoder::termDestination(j_compress_ptr cinfo) {
+  JpegEncoder *e = (JpegEncoder *)cinfo->client_data;
+  e->out_size = e->out_buffer.size() - e->dest.free_in_buffer;
 }
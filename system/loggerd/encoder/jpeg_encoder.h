@@ -10,23 +10,43 @@
 #include "cereal/messaging/messaging.h"
 #include "msgq/visionipc/visionbuf.h"
 
+// Downscales NV12 frames to any thumbnail size and compresses them to JPEG. The
+// compressor and all buffers are kept across calls, so thumbnails are cheap
+// enough to generate on demand.
 class JpegEncoder {
 public:
   JpegEncoder(const std::string &pusblish_name, int width, int height);
   ~JpegEncoder();
   void pushThumbnail(VisionBuf *buf, const VisionIpcBufExtra &extra);
+  // Returns the JPEG of the frame, valid until the next call. Repeated calls for
+  // the same frame_id return the cached thumbnail.
+  kj::ArrayPtr<const uint8_t> getThumbnail(const VisionBuf *buf, uint32_t frame_id);
 
 private:
   void generateThumbnail(const uint8_t *y, const uint8_t *uv, int width, int height, int stride);
-  void compressToJpeg(uint8_t *y_plane, uint8_t *u_plane, uint8_t *v_plane);
+  void compressToJpeg();
+
+  static void initDestination(j_compress_ptr cinfo);
+  static boolean emptyOutputBuffer(j_compress_ptr cinfo);
+  static void termDestination(j_compress_ptr cinfo);
 
   int thumbnail_width;
   int thumbnail_height;
   std::string publish_name;
-  std::vector<uint8_t> yuv_buffer;
   std::unique_ptr<PubMaster> pm;
 
+  // planar thumbnail, rows padded for jpeg_write_raw_data
+  int y_stride, uv_stride;
+  std::vector<uint8_t> y_plane, u_plane, v_plane;
+  std::vector<uint16_t> uv_plane;  // scaled NV12 chroma before deinterleaving
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  struct jpeg_destination_mgr dest;
+
   // JPEG output buffer
-  unsigned char* out_buffer = nullptr;
-  unsigned long out_size = 0;
+  std::vector<uint8_t> out_buffer;
+  size_t out_size = 0;
+  bool has_thumbnail = false;
+  uint32_t thumbnail_frame_id = 0;
 };
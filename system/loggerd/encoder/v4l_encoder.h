@@ -21,11 +21,12 @@ private:
   int segment_num = -1;
   int counter = 0;
 
-  SafeQueue<VisionIpcBufExtra> extras;
+  SpscQueue<VisionIpcBufExtra> extras;
 
   static void dequeue_handler(V4LEncoder *e);
   std::thread dequeue_handler_thread;
 
   VisionBuf buf_out[BUF_OUT_COUNT];
-  SafeQueue<unsigned int> free_buf_in;
+  // returned by the dequeue thread, and by encoder_close() on the encoder thread
+  MpscQueue<unsigned int> free_buf_in;
 };
@@ -1,4 +1,10 @@
+#include <time.h>
+
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 
 #include "system/loggerd/loggerd.h"
 #include "system/loggerd/encoder/jpeg_encoder.h"
@@ -11,6 +17,9 @@
 #define Encoder FfmpegEncoder
 #endif
 
+// frames between the CPU time reports
+constexpr int CPU_REPORT_FRAMES = 20 * MAIN_FPS;
+
 ExitHandler do_exit;
 
 struct EncoderdState {
@@ -44,6 +53,75 @@ bool sync_encoders(EncoderdState *s, VisionStreamType cam_type, uint32_t frame_i
   }
 }
 
+static uint64_t thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Runs the encoders of a camera in parallel. The calling thread takes part, so
+// a camera with n encoders needs n - 1 workers.
+class EncoderPool {
+public:
+  EncoderPool(int workers) {
+    for (int i = 0; i < workers; ++i) threads.emplace_back(&EncoderPool::workerThread, this);
+  }
+  ~EncoderPool() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads) t.join();
+  }
+
+  // Calls fn(i) for every i in [0, n) and returns once all calls are done.
+  void run(int n, const std::function<void(int)> &fn) {
+    {
+      std::lock_guard lk(lock);
+      task = &fn;
+      count = n;
+      done = 0;
+      next = 0;
+      ++generation;
+    }
+    cv.notify_all();
+    work();
+    std::unique_lock lk(lock);
+    done_cv.wait(lk, [&] { return done == count; });
+  }
+
+private:
+  void work() {
+    for (int i; (i = next++) < count;) {
+      (*task)(i);
+      if (++done == count) {
+        std::lock_guard lk(lock);
+        done_cv.notify_one();
+      }
+    }
+  }
+
+  void workerThread() {
+    uint64_t seen = 0;
+    while (true) {
+      std::unique_lock lk(lock);
+      cv.wait(lk, [&] { return exit || generation != seen; });
+      if (exit) break;
+      seen = generation;
+      lk.unlock();
+      work();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable cv, done_cv;
+  bool exit = false;
+  uint64_t generation = 0;
+  std::atomic<const std::function<void(int)> *> task = nullptr;
+  std::atomic<int> count = 0, next = 0, done = 0;
+  std::vector<std::thread> threads;
+};
 
 void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
   util::set_thread_name(cam_info.thread_name);
@@ -52,6 +130,16 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
 
   std::unique_ptr<JpegEncoder> jpeg_encoder;
+  std::unique_ptr<EncoderPool> pool;
+#ifndef __TICI__
+  // every frame is converted once for all encoders of the camera
+  std::shared_ptr<FrameConverter> converter;
+#endif
+
+  // CPU time spent on this camera's frames, summed over the threads
+  std::vector<uint64_t> encode_cpu_ns;
+  uint64_t convert_cpu_ns = 0;
+  int cpu_frames = 0;
 
   int cur_seg = 0;
   while (!do_exit) {
@@ -66,10 +154,19 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
       LOGW("encoder %s init %zux%zu", cam_info.thread_name, buf_info.width, buf_info.height);
       assert(buf_info.width > 0 && buf_info.height > 0);
 
+#ifndef __TICI__
+      converter = std::make_shared<FrameConverter>(buf_info.width, buf_info.height);
+#endif
       for (const auto &encoder_info : cam_info.encoder_infos) {
+#ifdef __TICI__
         auto &e = encoders.emplace_back(new Encoder(encoder_info, buf_info.width, buf_info.height));
+#else
+        auto &e = encoders.emplace_back(new Encoder(encoder_info, buf_info.width, buf_info.height, converter));
+#endif
         e->encoder_open();
       }
+      pool = std::make_unique<EncoderPool>(encoders.size() - 1);
+      encode_cpu_ns.assign(encoders.size(), 0);
 
       // Only one thumbnail can be generated per camera stream
       if (auto thumbnail_name = cam_info.encoder_infos[0].thumbnail_name) {
@@ -108,13 +205,30 @@ void encoder_thread(EncoderdState *s, const LogCameraInfo &cam_info) {
         ++cur_seg;
       }
 
+#ifndef __TICI__
+      const uint64_t convert_start = thread_cpu_ns();
+      converter->convert(buf);
+      convert_cpu_ns += thread_cpu_ns() - convert_start;
+#endif
+
       // encode a frame
-      for (int i = 0; i < encoders.size(); ++i) {
+      pool->run(encoders.size(), [&](int i) {
+        const uint64_t start = thread_cpu_ns();
         int out_id = encoders[i]->encode_frame(buf, &extra);
+        encode_cpu_ns[i] += thread_cpu_ns() - start;
 
         if (out_id == -1) {
           LOGE("Failed to encode frame. frame_id: %d", extra.frame_id);
         }
+      });
+
+      if (++cpu_frames == CPU_REPORT_FRAMES) {
+        uint64_t total_ns = convert_cpu_ns;
+        for (auto &ns : encode_cpu_ns) total_ns += std::exchange(ns, 0);
+        LOGD("encoder %s: %.2f ms CPU per frame, %.2f ms converting", cam_info.thread_name,
+             total_ns / 1e6 / cpu_frames, convert_cpu_ns / 1e6 / cpu_frames);
+        convert_cpu_ns = 0;
+        cpu_frames = 0;
       }
 
       if (jpeg_encoder && (extra.frame_id % 1200 == 100)) {
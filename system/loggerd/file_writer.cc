@@ -0,0 +1,246 @@
+#include "system/loggerd/file_writer.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <thread>
+
+#include "common/queue.h"
+#include "common/swaglog.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/hardware/hw.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT 0  // macOS
+#endif
+
+namespace {
+
+class StdioFileWriter : public FileWriter {
+public:
+  StdioFileWriter(const std::string &path, const FileWriterOptions &options) : options_(options) {
+    file_ = util::safe_fopen(path.c_str(), "wb");
+    assert(file_);
+    last_flush_ns_ = nanos_since_boot();
+  }
+  ~StdioFileWriter() { close(); }
+
+  bool write(const void *data, size_t size) override {
+    if (util::safe_fwrite(data, 1, size, file_) != size) return false;
+    unsynced_ += size;
+    if (options_.sync == SyncPolicy::INTERVAL && unsynced_ >= options_.sync_interval) {
+      unsynced_ = 0;
+      last_flush_ns_ = nanos_since_boot();
+      return util::safe_fflush(file_) == 0 && HANDLE_EINTR(fdatasync(fileno(file_))) == 0;
+    }
+    if (options_.flush_interval_ms > 0 && nanos_since_boot() - last_flush_ns_ >= options_.flush_interval_ms * 1000000ULL) {
+      return flush();
+    }
+    return true;
+  }
+
+  bool flush() override {
+    last_flush_ns_ = nanos_since_boot();
+    return util::safe_fflush(file_) == 0;
+  }
+
+  bool close() override {
+    if (!file_) return true;
+    bool ok = util::safe_fflush(file_) == 0;
+    if (options_.sync != SyncPolicy::NONE) {
+      ok = HANDLE_EINTR(fdatasync(fileno(file_))) == 0 && ok;
+    }
+    ok = fclose(file_) == 0 && ok;
+    file_ = nullptr;
+    return ok;
+  }
+
+private:
+  const FileWriterOptions options_;
+  FILE *file_ = nullptr;
+  size_t unsynced_ = 0;
+  uint64_t last_flush_ns_ = 0;
+};
+
+// Collects the data into large aligned blocks, which an I/O thread writes with O_DIRECT.
+// The last block is padded to the alignment and the file truncated to its real size on close.
+// flush() writes the partial block the same way, its unaligned tail is carried over into the
+// next block, which writes it again once it has more data.
+class DirectFileWriter : public FileWriter {
+public:
+  static constexpr size_t ALIGNMENT = 4096;
+  static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+  static constexpr int BLOCKS = 4;
+
+  DirectFileWriter(const std::string &path, const FileWriterOptions &options) : options_(options) {
+    fd_ = HANDLE_EINTR(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0664));
+    if (fd_ < 0 && errno == EINVAL) {
+      // e.g. tmpfs, the aligned block writes still apply
+      LOGW("O_DIRECT not supported for %s", path.c_str());
+      fd_ = HANDLE_EINTR(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664));
+    }
+    assert(fd_ >= 0);
+
+    for (int i = 0; i < BLOCKS; ++i) {
+      Block block;
+      int err = posix_memalign((void **)&block.data, ALIGNMENT, BLOCK_SIZE);
+      assert(err == 0);
+      if (i == 0) {
+        current_ = block;
+      } else {
+        free_blocks_.push(block);
+      }
+    }
+    last_flush_ns_ = nanos_since_boot();
+    io_thread_ = std::thread(&DirectFileWriter::ioThread, this);
+  }
+
+  ~DirectFileWriter() { close(); }
+
+  bool write(const void *data, size_t size) override {
+    const char *src = (const char *)data;
+    while (size > 0) {
+      const size_t n = std::min(size, BLOCK_SIZE - current_.size);
+      memcpy(current_.data + current_.size, src, n);
+      current_.size += n;
+      total_ += n;
+      src += n;
+      size -= n;
+      if (current_.size == BLOCK_SIZE) {
+        const size_t offset = current_.offset + BLOCK_SIZE;
+        full_blocks_.push(current_);
+        current_ = free_blocks_.pop();
+        current_.offset = offset;
+        flushed_ = 0;
+      }
+    }
+    if (options_.flush_interval_ms > 0 && nanos_since_boot() - last_flush_ns_ >= options_.flush_interval_ms * 1000000ULL) {
+      flush();
+    }
+    return !failed_;
+  }
+
+  bool flush() override {
+    last_flush_ns_ = nanos_since_boot();
+    if (current_.size == flushed_) return !failed_;
+
+    const size_t aligned = current_.size / ALIGNMENT * ALIGNMENT;
+    Block next = free_blocks_.pop();
+    next.offset = current_.offset + aligned;
+    next.size = current_.size - aligned;
+    memcpy(next.data, current_.data + aligned, next.size);
+
+    const size_t padded = (current_.size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    memset(current_.data + current_.size, 0, padded - current_.size);
+    current_.size = padded;
+    full_blocks_.push(current_);
+    current_ = next;
+    flushed_ = current_.size;
+    return !failed_;
+  }
+
+  bool close() override {
+    if (fd_ < 0) return true;
+
+    const size_t padded = (current_.size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    memset(current_.data + current_.size, 0, padded - current_.size);
+    current_.size = padded;
+    current_.last = true;
+    full_blocks_.push(current_);
+    io_thread_.join();
+
+    bool ok = !failed_ && HANDLE_EINTR(ftruncate(fd_, total_)) == 0;
+    if (options_.sync != SyncPolicy::NONE) {
+      ok = HANDLE_EINTR(fdatasync(fd_)) == 0 && ok;
+    }
+    ok = ::close(fd_) == 0 && ok;
+    fd_ = -1;
+
+    Block block;
+    while (free_blocks_.try_pop(block)) free(block.data);
+    return ok;
+  }
+
+private:
+  struct Block {
+    char *data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;  // in the file, a multiple of ALIGNMENT
+    bool last = false;
+  };
+
+  void ioThread() {
+    util::set_thread_name("loggerd_io");
+    size_t unsynced = 0;
+    while (true) {
+      Block block = full_blocks_.pop();
+      for (size_t pos = 0; pos < block.size && !failed_;) {
+        ssize_t ret = HANDLE_EINTR(pwrite(fd_, block.data + pos, block.size - pos, block.offset + pos));
+        if (ret <= 0) {
+          LOGE("failed to write file. errno=%d", errno);
+          failed_ = true;
+        } else {
+          pos += ret;
+        }
+      }
+      unsynced += block.size;
+      if (options_.sync == SyncPolicy::INTERVAL && unsynced >= options_.sync_interval) {
+        // O_DIRECT data is already on the device, this flushes its cache and the file size
+        failed_ = failed_ || HANDLE_EINTR(fdatasync(fd_)) != 0;
+        unsynced = 0;
+      }
+
+      if (block.last) {
+        free(block.data);
+        break;
+      }
+      block.size = 0;
+      free_blocks_.push(block);
+    }
+  }
+
+  const FileWriterOptions options_;
+  int fd_ = -1;
+  Block current_;
+  size_t flushed_ = 0;  // size of current_ when it was last flushed
+  uint64_t last_flush_ns_ = 0;
+  size_t total_ = 0;  // bytes written so far, without the padding
+  std::atomic<bool> failed_ = false;
+  SpscQueue<Block> free_blocks_{BLOCKS};
+  SpscQueue<Block> full_blocks_{BLOCKS};
+  std::thread io_thread_;
+};
+
+} // namespace
+
+FileWriterOptions segment_file_options() {
+  static const FileWriterOptions options = []() {
+    FileWriterOptions o = {
+      .backend = Hardware::PC() ? FileBackend::STDIO : FileBackend::DIRECT,
+      .sync = SyncPolicy::CLOSE,
+      .flush_interval_ms = 1000,
+    };
+    if (const char *backend = getenv("LOGGERD_FILE_BACKEND")) {
+      if (strcmp(backend, "stdio") == 0) {
+        o.backend = FileBackend::STDIO;
+      } else if (strcmp(backend, "direct") == 0) {
+        o.backend = FileBackend::DIRECT;
+      }
+    }
+    return o;
+  }();
+  return options;
+}
+
+std::unique_ptr<FileWriter> FileWriter::create(const std::string &path, const FileWriterOptions &options) {
+  if (options.backend == FileBackend::DIRECT) {
+    return std::make_unique<DirectFileWriter>(path, options);
+  }
+  return std::make_unique<StdioFileWriter>(path, options);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+enum class FileBackend {
+  STDIO,   // buffered FILE*, the page cache is written back whenever the kernel decides to
+  DIRECT,  // O_DIRECT writes of aligned blocks from a ring of buffers on an I/O thread, bypassing the page cache
+};
+
+enum class SyncPolicy {
+  NONE,      // never fdatasync
+  CLOSE,     // fdatasync when the file is closed, i.e. once per segment
+  INTERVAL,  // fdatasync every sync_interval bytes and on close
+};
+
+struct FileWriterOptions {
+  FileBackend backend = FileBackend::STDIO;
+  SyncPolicy sync = SyncPolicy::NONE;
+  size_t sync_interval = 0;
+  // how long data may stay buffered in the writer before it is written out, 0 waits for full buffers
+  uint32_t flush_interval_ms = 0;
+};
+
+// Options for the files of a log segment. The backend can be set with LOGGERD_FILE_BACKEND=stdio|direct,
+// it defaults to direct on device. The files are synced when the segment is closed, buffered data
+// is written out every second.
+FileWriterOptions segment_file_options();
+
+// Sequential output file. Not thread safe.
+class FileWriter {
+public:
+  static std::unique_ptr<FileWriter> create(const std::string &path, const FileWriterOptions &options = {});
+  virtual ~FileWriter() = default;
+  // returns false if the data couldn't be written
+  virtual bool write(const void *data, size_t size) = 0;
+  // writes out buffered data, so it isn't lost if the process dies
+  virtual bool flush() = 0;
+  // flushes, syncs according to the policy and closes the file, also done by the destructor
+  virtual bool close() = 0;
+};
@@ -158,7 +158,18 @@ static void log_sentinel(LoggerState *log, SentinelType type, int exit_signal =
   auto sen = msg.initEvent().initSentinel();
   sen.setType(type);
   sen.setSignal(exit_signal);
-  log->write(msg.toBytes(), true);
+  log->write(msg, true);
+}
+
+static void log_writer_stats(const std::string &name, const ZstdFileWriter &writer) {
+  const ZstdWriterStats &stats = writer.stats();
+  if (stats.stalls > 0) {
+    LOGW("%s: compression stalled %lu writes for %.1f ms (max %.1f ms)", name.c_str(), stats.stalls.load(),
+         stats.stall_ns / 1e6, stats.max_stall_ns / 1e6);
+  }
+  if (stats.write_errors > 0) {
+    LOGE("%s: %lu failed writes", name.c_str(), stats.write_errors.load());
+  }
 }
 
 LoggerState::LoggerState(const std::string &log_root) {
@@ -178,6 +189,8 @@ bool LoggerState::next() {
   if (rlog) {
     log_sentinel(this, SentinelType::END_OF_SEGMENT);
     std::remove(lock_file.c_str());
+    log_writer_stats(segment_path + "/rlog", *rlog);
+    log_writer_stats(segment_path + "/qlog", *qlog);
   }
 
   segment_path = route_path + "--" + std::to_string(++part);
@@ -187,8 +200,10 @@ bool LoggerState::next() {
   lock_file = segment_path + "/rlog.lock";
   std::ofstream{lock_file};
 
-  rlog.reset(new ZstdFileWriter(segment_path + "/rlog.zst", LOG_COMPRESSION_LEVEL));
-  qlog.reset(new ZstdFileWriter(segment_path + "/qlog.zst", LOG_COMPRESSION_LEVEL));
+  rlog.reset(new ZstdFileWriter(segment_path + "/rlog.zst", LOG_COMPRESSION_LEVEL, 0, segment_file_options()));
+  qlog.reset(new ZstdFileWriter(segment_path + "/qlog.zst", LOG_COMPRESSION_LEVEL, 0, segment_file_options()));
+  rlog->setSeekable(LOG_FRAME_MAX_BYTES, RLOG_FRAME_NS);
+  qlog->setSeekable(LOG_FRAME_MAX_BYTES, QLOG_FRAME_NS);
 
   // log init data & sentinel type.
   write(init_data.asBytes(), true);
@@ -197,6 +212,28 @@ bool LoggerState::next() {
 }
 
 void LoggerState::write(uint8_t* data, size_t size, bool in_qlog) {
-  rlog->write(data, size);
-  if (in_qlog) qlog->write(data, size);
+  // logMonoTime and type of the event for the seek index
+  uint64_t mono_time = 0;
+  int which = -1;
+  try {
+    capnp::FlatArrayMessageReader reader(kj::ArrayPtr<const capnp::word>((const capnp::word *)data, size / sizeof(capnp::word)));
+    auto event = reader.getRoot<cereal::Event>();
+    mono_time = event.getLogMonoTime();
+    which = event.which();
+  } catch (const kj::Exception &e) {
+    LOGE("failed to parse event for the log index: %s", e.getDescription().cStr());
+  }
+
+  rlog->write(data, size, mono_time, which);
+  if (in_qlog) qlog->write(data, size, mono_time, which);
+}
+
+size_t LoggerState::write(MessageBuilder &msg, bool in_qlog) {
+  auto event = msg.getRoot<cereal::Event>();
+  const uint64_t mono_time = event.getLogMonoTime();
+  const int which = event.which();
+  auto segments = msg.getSegmentsForOutput();
+  rlog->write(segments, mono_time, which);
+  if (in_qlog) qlog->write(segments, mono_time, which);
+  return capnp::computeSerializedSizeInWords(segments) * sizeof(capnp::word);
 }
@@ -10,6 +10,10 @@
 #include "system/loggerd/zstd_writer.h"
 
 constexpr int LOG_COMPRESSION_LEVEL = 10;
+// rlog and qlog are split into independent zstd frames so readers can decompress parts of them
+constexpr size_t LOG_FRAME_MAX_BYTES = 8 * 1024 * 1024;
+constexpr uint64_t RLOG_FRAME_NS = 1e9;
+constexpr uint64_t QLOG_FRAME_NS = 10e9;
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
@@ -23,6 +27,8 @@ public:
   inline const std::string& segmentPath() const { return segment_path; }
   inline const std::string& routeName() const { return route_name; }
   inline void write(kj::ArrayPtr<kj::byte> bytes, bool in_qlog) { write(bytes.begin(), bytes.size(), in_qlog); }
+  // serializes straight into the log writers, returns the serialized size
+  size_t write(MessageBuilder &msg, bool in_qlog);
   inline void setExitSignal(int signal) { exit_signal = signal; }
 
 protected:
@@ -2,34 +2,72 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "common/params.h"
+#include "common/queue.h"
 #include "system/loggerd/encoder/encoder.h"
 #include "system/loggerd/loggerd.h"
 #include "system/loggerd/video_writer.h"
 
 ExitHandler do_exit;
 
+// An item for the log thread, which owns the rlog and qlog writers.
+struct LogEntry {
+  enum class Type { MESSAGE, ENCODE_IDX, ROTATE, EXIT };
+  Type type = Type::MESSAGE;
+  Message *msg = nullptr;  // deleted by the log thread
+  bool in_qlog = false;
+  const EncoderInfo *encoder_info = nullptr;  // of an ENCODE_IDX packet
+};
+
 struct LoggerdState {
-  LoggerState logger;
+  LoggerState logger;  // only touched by the log thread once it runs
   std::atomic<double> last_camera_seen_tms{0.0};
-  std::atomic<int> ready_to_rotate{0};  // count of encoders ready to rotate
+  std::atomic<double> last_rotate_tms{0.0};  // last rotate time in ms
   int max_waiting = 0;
-  double last_rotate_tms = 0.;      // last rotate time in ms
+
+  // Rotation is a barrier across the encoder threads: each one marks itself ready once it
+  // gets a packet of the next segment, then the main thread queues the rotation behind
+  // everything logged so far. segment_lock orders the ready marks with the rotation.
+  std::mutex segment_lock;
+  std::string segment_path;             // guarded by segment_lock
+  std::atomic<int> segment{-1};         // written under segment_lock
+  std::atomic<int> ready_to_rotate{0};  // count of encoders ready to rotate, written under segment_lock
+  std::atomic<bool> rotate_pending{false};
+
+  // each socket is read by one thread, so the queue keeps every socket's messages in order
+  MpscQueue<LogEntry> log_queue{2048};
+  ReusableMessageBuilder encode_idx_builder{256};  // for the *EncodeIdx events, which are small
 };
 
+int current_segment(LoggerdState *s, std::string *path = nullptr) {
+  std::lock_guard lk(s->segment_lock);
+  if (path) *path = s->segment_path;
+  return s->segment;
+}
+
 void logger_rotate(LoggerdState *s) {
   bool ret =s->logger.next();
   assert(ret);
-  s->ready_to_rotate = 0;
+  {
+    std::lock_guard lk(s->segment_lock);
+    s->segment_path = s->logger.segmentPath();
+    s->segment = s->logger.segment();
+    s->ready_to_rotate = 0;
+  }
   s->last_rotate_tms = millis_since_boot();
+  s->rotate_pending = false;
   LOGW((s->logger.segment() == 0) ? "logging to %s" : "rotated to %s", s->logger.segmentPath().c_str());
 }
 
 void rotate_if_needed(LoggerdState *s) {
+  if (s->rotate_pending) return;
+
   // all encoders ready, trigger rotation
   bool all_ready = s->ready_to_rotate == s->max_waiting;
 
@@ -49,10 +87,20 @@ void rotate_if_needed(LoggerdState *s) {
   }
 
   if (all_ready || timed_out) {
-    logger_rotate(s);
+    // the encoder threads queued their last packets of the segment before marking themselves ready
+    s->rotate_pending = true;
+    s->log_queue.push({.type = LogEntry::Type::ROTATE});
   }
 }
 
+// rawAudioData samples, the data is shared by all the encoders with audio
+struct AudioChunk {
+  std::shared_ptr<const std::vector<uint8_t>> data;
+  long long timestamp;
+  int sample_rate;
+};
+
+// Used only by its encoder thread, the main thread hands over the audio through audio_queue.
 struct RemoteEncoder {
   std::unique_ptr<VideoWriter> writer;
   int encoderd_segment_offset;
@@ -63,9 +111,14 @@ struct RemoteEncoder {
   bool marked_ready_to_rotate = false;
   bool seen_first_packet = false;
   bool audio_initialized = false;
+  SpscQueue<AudioChunk> audio_queue{64};  // about 3s of rawAudioData
+  int dropped_audio = 0;
 };
 
-size_t write_encode_data(LoggerdState *s, cereal::Event::Reader event, RemoteEncoder &re, const EncoderInfo &encoder_info) {
+// Writes the packet into the video file and queues its idx event for the log thread, which takes over msg.
+void write_encode_data(LoggerdState *s, Message *msg, RemoteEncoder &re, const EncoderInfo &encoder_info) {
+  capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<capnp::word>((capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word)));
+  auto event = cmsg.getRoot<cereal::Event>();
   auto edata = (event.*(encoder_info.get_encode_data_func))();
   auto idx = edata.getIdx();
   auto flags = idx.getFlags();
@@ -89,7 +142,8 @@ size_t write_encode_data(LoggerdState *s, cereal::Event::Reader event, RemoteEnc
       // this is a sad case when we aren't recording, but don't have an iframe
       // nothing we can do but drop the frame
       ++re.dropped_frames;
-      return 0;
+      delete msg;
+      return;
     }
   }
 
@@ -103,18 +157,23 @@ size_t write_encode_data(LoggerdState *s, cereal::Event::Reader event, RemoteEnc
   }
 
   // put it in log stream as the idx packet
-  MessageBuilder bmsg;
+  s->log_queue.push({.type = LogEntry::Type::ENCODE_IDX, .msg = msg, .in_qlog = true, .encoder_info = &encoder_info});  // always in qlog?
+}
+
+// Called on the log thread
+size_t write_encode_idx(LoggerdState *s, Message *msg, const EncoderInfo &encoder_info) {
+  capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<capnp::word>((capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word)));
+  auto event = cmsg.getRoot<cereal::Event>();
+  auto idx = (event.*(encoder_info.get_encode_data_func))().getIdx();
+
+  MessageBuilder &bmsg = s->encode_idx_builder.reset();
   auto evt = bmsg.initEvent(event.getValid());
   evt.setLogMonoTime(event.getLogMonoTime());
   (evt.*(encoder_info.set_encode_idx_func))(idx);
-  auto new_msg = bmsg.toBytes();
-  s->logger.write((uint8_t *)new_msg.begin(), new_msg.size(), true);  // always in qlog?
-  return new_msg.size();
+  return s->logger.write(bmsg, true);
 }
 
-int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct RemoteEncoder &re, const EncoderInfo &encoder_info) {
-  int bytes_count = 0;
-
+void handle_encoder_msg(LoggerdState *s, Message *msg, const std::string &name, struct RemoteEncoder &re, const EncoderInfo &encoder_info) {
   // extract the message
   capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<capnp::word>((capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word)));
   auto event = cmsg.getRoot<cereal::Event>();
@@ -129,49 +188,50 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
   }
   int offset_segment_num = idx.getSegmentNum() - re.encoderd_segment_offset;
 
-  if (offset_segment_num == s->logger.segment()) {
+  std::string segment_path;
+  const int segment = current_segment(s, &segment_path);
+  if (offset_segment_num == segment) {
     // loggerd is now on the segment that matches this packet
 
     // if this is a new segment, we close any possible old segments, move to the new, and process any queued packets
-    if (re.current_segment != s->logger.segment()) {
+    if (re.current_segment != segment) {
       // if we aren't actually recording, don't create the writer
       if (encoder_info.record) {
         assert(encoder_info.filename != NULL);
-        re.writer.reset(new VideoWriter(s->logger.segmentPath().c_str(),
+        re.writer.reset(new VideoWriter(segment_path.c_str(),
                                         encoder_info.filename, idx.getType() != cereal::EncodeIndex::Type::FULL_H_E_V_C,
                                         edata.getWidth(), edata.getHeight(), encoder_info.fps, idx.getType()));
         re.recording = false;
         re.audio_initialized = false;
       }
-      re.current_segment = s->logger.segment();
+      re.current_segment = segment;
       re.marked_ready_to_rotate = false;
     }
     if (re.audio_initialized || !encoder_info.include_audio) {
       // we are in this segment now, process any queued messages before this one
-      if (!re.q.empty()) {
-        for (auto qmsg : re.q) {
-          capnp::FlatArrayMessageReader reader({(capnp::word *)qmsg->getData(), qmsg->getSize() / sizeof(capnp::word)});
-          bytes_count += write_encode_data(s, reader.getRoot<cereal::Event>(), re, encoder_info);
-          delete qmsg;
-        }
-        re.q.clear();
+      for (auto qmsg : re.q) {
+        write_encode_data(s, qmsg, re, encoder_info);
       }
-      bytes_count += write_encode_data(s, event, re, encoder_info);
-      delete msg;
+      re.q.clear();
+      write_encode_data(s, msg, re, encoder_info);
     } else if (re.q.size() > MAIN_FPS*10) {
       LOGE_100("%s: dropping frame waiting for audio initialization, queue is too large", name.c_str());
       delete msg;
     } else {
       re.q.push_back(msg); // queue up all the new segment messages, they go in after audio is initialized
     }
-  } else if (offset_segment_num > s->logger.segment()) {
+  } else if (offset_segment_num > segment) {
     // encoderd packet has a newer segment, this means encoderd has rolled over
     if (!re.marked_ready_to_rotate) {
-      re.marked_ready_to_rotate = true;
-      ++s->ready_to_rotate;
-      LOGD("rotate %d -> %d ready %d/%d for %s",
-        s->logger.segment(), offset_segment_num,
-        s->ready_to_rotate.load(), s->max_waiting, name.c_str());
+      std::lock_guard segment_lk(s->segment_lock);
+      // don't count towards a rotation that happened since segment was read
+      if (offset_segment_num > s->segment) {
+        re.marked_ready_to_rotate = true;
+        ++s->ready_to_rotate;
+        LOGD("rotate %d -> %d ready %d/%d for %s",
+          segment, offset_segment_num,
+          s->ready_to_rotate.load(), s->max_waiting, name.c_str());
+      }
     }
 
     // TODO: define this behavior, but for now don't leak
@@ -183,30 +243,92 @@ int handle_encoder_msg(LoggerdState *s, Message *msg, std::string &name, struct
       re.q.push_back(msg);
     }
   } else {
-    LOGE("%s: encoderd packet has a older segment!!! idx.getSegmentNum():%d s->logger.segment():%d re.encoderd_segment_offset:%d",
-      name.c_str(), idx.getSegmentNum(), s->logger.segment(), re.encoderd_segment_offset);
+    LOGE("%s: encoderd packet has a older segment!!! idx.getSegmentNum():%d segment:%d re.encoderd_segment_offset:%d",
+      name.c_str(), idx.getSegmentNum(), segment, re.encoderd_segment_offset);
     // free the message, it's useless. this should never happen
     // actually, this can happen if you restart encoderd
-    re.encoderd_segment_offset = -s->logger.segment();
+    re.encoderd_segment_offset = -segment;
     delete msg;
   }
+}
 
-  return bytes_count;
+// Writes the audio that came in before the next packet into the current video file, if there is one
+void write_queued_audio(RemoteEncoder &re) {
+  AudioChunk chunk;
+  while (re.audio_queue.try_pop(chunk)) {
+    if (re.writer) {
+      re.writer->write_audio((uint8_t *)chunk.data->data(), chunk.data->size(), chunk.timestamp, chunk.sample_rate);
+      re.audio_initialized = true;
+    }
+  }
+}
+
+// Each encoder stream is muxed on its own thread, so a large packet doesn't hold up the other streams or the log.
+void encoder_thread(LoggerdState *s, SubSocket *sock, std::string name, RemoteEncoder *re, const EncoderInfo *encoder_info) {
+  util::set_thread_name(("loggerd_" + name).c_str());
+  std::unique_ptr<Poller> poller(Poller::create());
+  poller->registerSocket(sock);
+
+  while (!do_exit) {
+    if (poller->poll(100).empty()) {
+      write_queued_audio(*re);
+      continue;
+    }
+
+    Message *msg = nullptr;
+    while (!do_exit && (msg = sock->receive(true))) {
+      s->last_camera_seen_tms = millis_since_boot();
+      write_queued_audio(*re);
+      handle_encoder_msg(s, msg, name, *re, *encoder_info);
+    }
+  }
+
+  for (auto qmsg : re->q) delete qmsg;
+  re->q.clear();
+}
+
+void log_thread(LoggerdState *s) {
+  util::set_thread_name("loggerd_log");
+
+  uint64_t msg_count = 0, bytes_count = 0;
+  double start_ts = millis_since_boot();
+  while (true) {
+    LogEntry entry = s->log_queue.pop();
+    if (entry.type == LogEntry::Type::EXIT) {
+      break;
+    } else if (entry.type == LogEntry::Type::ROTATE) {
+      logger_rotate(s);
+      continue;
+    } else if (entry.type == LogEntry::Type::ENCODE_IDX) {
+      bytes_count += write_encode_idx(s, entry.msg, *entry.encoder_info);
+    } else {
+      s->logger.write((uint8_t *)entry.msg->getData(), entry.msg->getSize(), entry.in_qlog);
+      bytes_count += entry.msg->getSize();
+    }
+    delete entry.msg;
+
+    if ((++msg_count % 10000) == 0) {
+      double seconds = (millis_since_boot() - start_ts) / 1000.0;
+      LOGD("%" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+    }
+  }
 }
 
 void handle_preserve_segment(LoggerdState *s) {
   static int prev_segment = -1;
-  if (s->logger.segment() == prev_segment) return;
+  std::string segment_path;
+  const int segment = current_segment(s, &segment_path);
+  if (segment == prev_segment) return;
 
-  LOGW("preserving %s", s->logger.segmentPath().c_str());
+  LOGW("preserving %s", segment_path.c_str());
 
 #ifdef __APPLE__
-  int ret = setxattr(s->logger.segmentPath().c_str(), PRESERVE_ATTR_NAME, &PRESERVE_ATTR_VALUE, 1, 0, 0);
+  int ret = setxattr(segment_path.c_str(), PRESERVE_ATTR_NAME, &PRESERVE_ATTR_VALUE, 1, 0, 0);
 #else
-  int ret = setxattr(s->logger.segmentPath().c_str(), PRESERVE_ATTR_NAME, &PRESERVE_ATTR_VALUE, 1, 0);
+  int ret = setxattr(segment_path.c_str(), PRESERVE_ATTR_NAME, &PRESERVE_ATTR_VALUE, 1, 0);
 #endif
   if (ret) {
-    LOGE("setxattr %s failed for %s: %s", PRESERVE_ATTR_NAME, s->logger.segmentPath().c_str(), strerror(errno));
+    LOGE("setxattr %s failed for %s: %s", PRESERVE_ATTR_NAME, segment_path.c_str(), strerror(errno));
   }
 
   // mark route for uploading
@@ -214,7 +336,7 @@ void handle_preserve_segment(LoggerdState *s) {
   std::string routes = params.get("AthenadRecentlyViewedRoutes");
   params.put("AthenadRecentlyViewedRoutes", routes + "," + s->logger.routeName());
 
-  prev_segment = s->logger.segment();
+  prev_segment = segment;
 }
 
 void loggerd_thread() {
@@ -240,7 +362,8 @@ void loggerd_thread() {
 
       SubSocket * sock = SubSocket::create(ctx.get(), it.name);
       assert(sock != NULL);
-      poller->registerSocket(sock);
+      // encoder sockets are read by their own threads
+      if (!encoder) poller->registerSocket(sock);
       service_state[sock] = {
         .name = it.name,
         .counter = 0,
@@ -266,18 +389,21 @@ void loggerd_thread() {
     }
   }
 
+  std::thread logger(log_thread, &s);
+  std::vector<std::thread> encoder_threads;
   for (auto &[sock, service] : service_state) {
     auto it = encoder_infos_dict.find(service.name);
-    if (it != encoder_infos_dict.end() && it->second.include_audio) {
-      encoders_with_audio.push_back(&remote_encoders[sock]);
+    if (service.encoder) {
+      if (it != encoder_infos_dict.end() && it->second.include_audio) {
+        encoders_with_audio.push_back(&remote_encoders[sock]);
+      }
+      encoder_threads.emplace_back(encoder_thread, &s, sock, service.name, &remote_encoders[sock], &encoder_infos_dict[service.name]);
     }
   }
 
-  uint64_t msg_count = 0, bytes_count = 0;
-  double start_ts = millis_since_boot();
   while (!do_exit) {
     // poll for new messages on all sockets
-    for (auto sock : poller->poll(1000)) {
+    for (auto sock : poller->poll(100)) {
       if (do_exit) break;
 
       ServiceState &service = service_state[sock];
@@ -295,31 +421,22 @@ void loggerd_thread() {
           capnp::FlatArrayMessageReader cmsg(kj::ArrayPtr<capnp::word>((capnp::word *)msg->getData(), msg->getSize() / sizeof(capnp::word)));
           auto event = cmsg.getRoot<cereal::Event>();
           auto audio_data = event.getRawAudioData().getData();
-          auto sample_rate = event.getRawAudioData().getSampleRate();
+          // the encoder threads encode and mux it, so the other services aren't held up behind their packets
+          AudioChunk chunk = {
+            .data = std::make_shared<const std::vector<uint8_t>>(audio_data.begin(), audio_data.end()),
+            .timestamp = (long long)(event.getLogMonoTime() / 1000),
+            .sample_rate = (int)event.getRawAudioData().getSampleRate(),
+          };
           for (auto* encoder : encoders_with_audio) {
-            if (encoder && encoder->writer) {
-              encoder->writer->write_audio((uint8_t*)audio_data.begin(), audio_data.size(), event.getLogMonoTime() / 1000, sample_rate);
-              encoder->audio_initialized = true;
+            if (!encoder->audio_queue.try_push(chunk)) {
+              LOGE_100("dropping audio, encoder is behind (%d dropped)", ++encoder->dropped_audio);
             }
           }
         }
 
-        if (service.encoder) {
-          s.last_camera_seen_tms = millis_since_boot();
-          bytes_count += handle_encoder_msg(&s, msg, service.name, remote_encoders[sock], encoder_infos_dict[service.name]);
-        } else {
-          s.logger.write((uint8_t *)msg->getData(), msg->getSize(), in_qlog);
-          bytes_count += msg->getSize();
-          delete msg;
-        }
-
+        s.log_queue.push({.type = LogEntry::Type::MESSAGE, .msg = msg, .in_qlog = in_qlog});
         rotate_if_needed(&s);
 
-        if ((++msg_count % 10000) == 0) {
-          double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
-        }
-
         count++;
         if (count >= 200) {
           LOGD("large volume of '%s' messages", service.name.c_str());
@@ -327,9 +444,14 @@ void loggerd_thread() {
         }
       }
     }
+    // the encoder threads can get ready while no other messages come in
+    rotate_if_needed(&s);
   }
 
   LOGW("closing logger");
+  for (auto &t : encoder_threads) t.join();
+  s.log_queue.push({.type = LogEntry::Type::EXIT});
+  logger.join();
   s.logger.setExitSignal(do_exit.signal);
 
   if (do_exit.power_failure) {
@@ -0,0 +1,90 @@
+// Replays the video packet sizes of a recorded segment through each FileWriter
+// backend and reports throughput and write() latency. Without an rlog, packets
+// of a 20fps HEVC stream with a keyframe every second are used.
+//
+// usage: bench_file_writer [rlog.zst] [output_dir=log root] [repeat=1]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/hardware/hw.h"
+#include "system/loggerd/file_writer.h"
+#include "system/loggerd/logger.h"
+
+static std::vector<size_t> packet_sizes(const std::string &rlog) {
+  std::vector<size_t> sizes;
+  if (rlog.empty()) {
+    for (int i = 0; i < 60 * 20; ++i) sizes.push_back(i % 20 == 0 ? 400 * 1024 : 50 * 1024);
+    return sizes;
+  }
+
+  std::string raw = util::read_file(rlog);
+  if (util::ends_with(rlog, ".zst")) raw = zstd_decompress(raw);
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)raw.data(), raw.size() / sizeof(capnp::word));
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    switch (event.which()) {
+      case cereal::Event::ROAD_ENCODE_IDX: sizes.push_back(event.getRoadEncodeIdx().getLen()); break;
+      case cereal::Event::WIDE_ROAD_ENCODE_IDX: sizes.push_back(event.getWideRoadEncodeIdx().getLen()); break;
+      case cereal::Event::DRIVER_ENCODE_IDX: sizes.push_back(event.getDriverEncodeIdx().getLen()); break;
+      default: break;
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+  return sizes;
+}
+
+int main(int argc, char **argv) {
+  const std::string rlog = argc > 1 ? argv[1] : "";
+  const std::string output_dir = argc > 2 ? argv[2] : Path::log_root();
+  const int repeat = argc > 3 ? atoi(argv[3]) : 1;
+
+  const std::vector<size_t> sizes = packet_sizes(rlog);
+  if (sizes.empty()) {
+    fprintf(stderr, "no encoder packets in %s\n", rlog.c_str());
+    return 1;
+  }
+  const size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  const std::string packet = util::random_string(max_size);
+  util::create_directories(output_dir, 0775);
+
+  printf("%zu packets, max %zu KB\n", sizes.size() * repeat, max_size / 1024);
+  printf("%-8s %-8s %10s %10s %10s %10s\n", "backend", "sync", "MB/s", "p50 us", "p99 us", "max us");
+  const std::pair<FileBackend, const char *> backends[] = {{FileBackend::STDIO, "stdio"}, {FileBackend::DIRECT, "direct"}};
+  const std::pair<SyncPolicy, const char *> policies[] = {{SyncPolicy::NONE, "none"}, {SyncPolicy::CLOSE, "close"}, {SyncPolicy::INTERVAL, "8MB"}};
+  for (auto &[backend, backend_name] : backends) {
+    for (auto &[sync, sync_name] : policies) {
+      const std::string path = output_dir + "/bench_file_writer.bin";
+      std::vector<double> latencies;
+      size_t total = 0;
+
+      const double start = millis_since_boot();
+      {
+        auto file = FileWriter::create(path, {.backend = backend, .sync = sync, .sync_interval = 8 * 1024 * 1024});
+        for (int r = 0; r < repeat; ++r) {
+          for (size_t size : sizes) {
+            const double t = nanos_since_boot();
+            file->write(packet.data(), size);
+            latencies.push_back((nanos_since_boot() - t) / 1e3);
+            total += size;
+          }
+        }
+        file->close();
+      }
+      const double seconds = (millis_since_boot() - start) / 1000.0;
+      ::unlink(path.c_str());
+
+      std::sort(latencies.begin(), latencies.end());
+      printf("%-8s %-8s %10.1f %10.1f %10.1f %10.1f\n", backend_name, sync_name, total / seconds / 1e6,
+             latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+    }
+  }
+  return 0;
+}
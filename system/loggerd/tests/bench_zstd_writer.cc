@@ -0,0 +1,67 @@
+// Writes a few seconds worth of rlog-like messages through ZstdFileWriter and
+// reports the throughput of write(), its worst latency and the compression stalls.
+//
+// usage: bench_zstd_writer [workers=0] [messages=20000] [output=/tmp/bench_zstd_writer.zst]
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/loggerd/logger.h"
+#include "system/loggerd/zstd_writer.h"
+
+int main(int argc, char **argv) {
+  const int workers = argc > 1 ? atoi(argv[1]) : 0;
+  const int msg_count = argc > 2 ? atoi(argv[2]) : 20000;
+  const std::string filename = argc > 3 ? argv[3] : "/tmp/bench_zstd_writer.zst";
+
+  // partly compressible messages, like capnp events with a fixed layout and changing fields
+  std::vector<std::string> msgs;
+  std::mt19937 rng(0);
+  const std::string layout = util::random_string(24);
+  for (int i = 0; i < msg_count; ++i) {
+    std::string msg;
+    size_t size = (i % 64 == 0) ? 16 * 1024 : 64 + (i * 37) % 1024;
+    while (msg.size() < size) {
+      msg += layout;
+      for (int j = 0; j < 8; ++j) msg += char(rng());
+    }
+    msgs.push_back(msg.substr(0, size));
+  }
+
+  size_t total_size = 0;
+  uint64_t max_write_ns = 0;
+  uint64_t start = nanos_since_boot(), write_end = 0;
+  {
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL, workers);
+    for (auto &msg : msgs) {
+      uint64_t t = nanos_since_boot();
+      writer.write(msg.data(), msg.size());
+      max_write_ns = std::max(max_write_ns, nanos_since_boot() - t);
+      total_size += msg.size();
+    }
+    write_end = nanos_since_boot();
+
+    const ZstdWriterStats &stats = writer.stats();
+    printf("workers %d: %.1f MB/s in write(), max write() %.1f us, stalls %" PRIu64 " (%.1f ms), max compress queue %" PRIu64 "\n",
+           workers, total_size / 1e6 / ((write_end - start) / 1e9), max_write_ns / 1e3, stats.stalls.load(),
+           stats.stall_ns / 1e6, stats.max_compress_queue.load());
+  }
+  uint64_t end = nanos_since_boot();
+
+  std::string compressed = util::read_file(filename);
+  printf("workers %d: %.1f MB/s end to end, ratio %.2f\n", workers, total_size / 1e6 / ((end - start) / 1e9),
+         (double)total_size / compressed.size());
+  std::remove(filename.c_str());
+  if (zstd_decompress(compressed).size() != total_size) {
+    fprintf(stderr, "decompressed size doesn't match\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <catch2/catch.hpp>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "system/loggerd/audio_buffer.h"
+
+static std::vector<int16_t> ramp(int16_t first, size_t count) {
+  std::vector<int16_t> samples(count);
+  std::iota(samples.begin(), samples.end(), first);
+  return samples;
+}
+
+static std::vector<float> to_float(const std::vector<int16_t> &samples) {
+  std::vector<float> floats;
+  for (int16_t s : samples) floats.push_back(s / 32768.0f);
+  return floats;
+}
+
+TEST_CASE("s16_to_float matches the scalar conversion", "[AudioBuffer]") {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> dist(INT16_MIN, INT16_MAX);
+  std::vector<int16_t> src(64 + 1);
+  for (auto &s : src) s = dist(rng);
+  src[0] = INT16_MIN;
+  src[1] = INT16_MAX;
+  src[2] = -1;
+
+  // lengths that aren't a multiple of the vector width, from an unaligned start as well
+  for (size_t offset : {0, 1}) {
+    for (size_t count = 0; count <= 64; ++count) {
+      std::vector<float> dst(count + 1, -2.0f);
+      s16_to_float(src.data() + offset, dst.data(), count);
+      for (size_t i = 0; i < count; ++i) {
+        REQUIRE(dst[i] == src[offset + i] / 32768.0f);
+      }
+      REQUIRE(dst[count] == -2.0f);
+    }
+  }
+}
+
+TEST_CASE("AudioBuffer wraps around", "[AudioBuffer]") {
+  AudioBuffer buffer;
+  buffer.resize(10);
+
+  auto samples = ramp(0, 7);
+  REQUIRE(buffer.write(samples.data(), samples.size()) == 0);
+  std::vector<float> out(5);
+  buffer.read(out.data(), 5);
+  REQUIRE(out == to_float(ramp(0, 5)));
+
+  // the write and the read wrap past the end of the ring
+  samples = ramp(7, 6);
+  REQUIRE(buffer.write(samples.data(), samples.size()) == 0);
+  REQUIRE(buffer.size() == 8);
+  out.resize(8);
+  buffer.read(out.data(), 8);
+  REQUIRE(out == to_float(ramp(5, 8)));
+  REQUIRE(buffer.size() == 0);
+}
+
+TEST_CASE("AudioBuffer drops the oldest samples on overflow", "[AudioBuffer]") {
+  AudioBuffer buffer;
+  buffer.resize(10);
+  auto samples = ramp(0, 6);
+  buffer.write(samples.data(), samples.size());
+  std::vector<float> out(3);
+  buffer.read(out.data(), 3);
+
+  SECTION("buffered samples are dropped first") {
+    // 3 buffered, 9 written: the 2 oldest buffered ones go
+    samples = ramp(6, 9);
+    REQUIRE(buffer.write(samples.data(), samples.size()) == 2);
+    REQUIRE(buffer.size() == 10);
+    out.resize(10);
+    buffer.read(out.data(), 10);
+    REQUIRE(out == to_float(ramp(5, 10)));
+  }
+  SECTION("then the start of the new samples") {
+    // more than the capacity: everything buffered and the first 2 new samples go
+    samples = ramp(6, 12);
+    REQUIRE(buffer.write(samples.data(), samples.size()) == 5);
+    REQUIRE(buffer.size() == 10);
+    out.resize(10);
+    buffer.read(out.data(), 10);
+    REQUIRE(out == to_float(ramp(8, 10)));
+  }
+  SECTION("the dropped count keeps the pts of the oldest sample") {
+    // VideoWriter advances audio_pts by the dropped samples, sample n has pts n
+    uint64_t pts = 3;
+    for (int16_t next = 6; next < 100; next += 7) {
+      samples = ramp(next, 7);
+      pts += buffer.write(samples.data(), samples.size());
+      buffer.read(out.data(), 1);
+      REQUIRE(out[0] == pts / 32768.0f);
+      pts += 1;
+    }
+  }
+}
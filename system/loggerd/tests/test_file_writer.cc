@@ -0,0 +1,70 @@
+#include <catch2/catch.hpp>
+#include <random>
+#include <string>
+
+#include "common/util.h"
+#include "system/loggerd/file_writer.h"
+
+TEST_CASE("FileWriter backends write identical files", "[FileWriter]") {
+  auto backend = GENERATE(FileBackend::STDIO, FileBackend::DIRECT);
+  auto sync = GENERATE(SyncPolicy::NONE, SyncPolicy::CLOSE, SyncPolicy::INTERVAL);
+  const std::string filename = "test_file_writer.bin";
+
+  // sizes around the block size, ending on a partial block
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<size_t> size_dist(0, 300 * 1024);
+  std::string expected;
+  {
+    auto file = FileWriter::create(filename, {.backend = backend, .sync = sync, .sync_interval = 1024 * 1024});
+    for (int i = 0; i < 50; ++i) {
+      std::string data = util::random_string(size_dist(rng));
+      REQUIRE(file->write(data.data(), data.size()));
+      expected += data;
+    }
+    REQUIRE(file->close());
+    // closing twice is fine, the destructor does it as well
+    REQUIRE(file->close());
+  }
+  REQUIRE(util::read_file(filename) == expected);
+
+  SECTION("empty file") {
+    FileWriter::create(filename, {.backend = backend, .sync = sync});
+    REQUIRE(util::read_file(filename).empty());
+  }
+  ::unlink(filename.c_str());
+}
+
+TEST_CASE("FileWriter writes out buffered data on flush", "[FileWriter]") {
+  auto backend = GENERATE(FileBackend::STDIO, FileBackend::DIRECT);
+  const bool interval = GENERATE(false, true);
+  const std::string filename = "test_file_writer_flush.bin";
+
+  // partial blocks that don't end on the alignment
+  std::string expected;
+  {
+    auto file = FileWriter::create(filename, {.backend = backend, .flush_interval_ms = interval ? 10u : 0u});
+    for (size_t size : {5000, 3000, 300 * 1024}) {
+      std::string data = util::random_string(size);
+      REQUIRE(file->write(data.data(), data.size()));
+      expected += data;
+      if (interval) {
+        util::sleep_for(20);
+        // the next write is past the interval
+        REQUIRE(file->write(nullptr, 0));
+      } else {
+        REQUIRE(file->flush());
+      }
+
+      // the file may still have the padding of the last flushed block
+      std::string contents;
+      for (int i = 0; i < 500 && contents.compare(0, expected.size(), expected) != 0; ++i) {
+        if (i > 0) util::sleep_for(10);
+        contents = util::read_file(filename);
+      }
+      REQUIRE(contents.compare(0, expected.size(), expected) == 0);
+    }
+    REQUIRE(file->close());
+  }
+  REQUIRE(util::read_file(filename) == expected);
+  ::unlink(filename.c_str());
+}
@@ -1,8 +1,24 @@
+#include <cstdlib>
+#include <new>
+
 #include "catch2/catch.hpp"
 #include "system/loggerd/logger.h"
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
+// count heap allocations made through operator new on threads that ask for it
+static thread_local bool count_allocations = false;
+static uint64_t heap_allocations = 0;
+
+void *operator new(size_t size) {
+  if (count_allocations) heap_allocations++;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
 void verify_segment(const std::string &route_path, int segment, int max_segment, int required_event_cnt) {
   const std::string segment_path = route_path + "--" + std::to_string(segment);
   SentinelType begin_sentinel = segment == 0 ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT;
@@ -73,3 +89,57 @@ TEST_CASE("logger") {
     verify_segment(log_root + "/" + route_name, i, segment_cnt, 1);
   }
 }
+
+TEST_CASE("LoggerState writes MessageBuilders without allocating") {
+  const std::string log_root = "/tmp/test_logger_alloc";
+  system(("rm " + log_root + " -rf").c_str());
+  const int iterations = 10000;
+
+  std::string segment_path;
+  size_t msg_size = 0;
+  {
+    LoggerState logger(log_root);
+    REQUIRE(logger.next());
+    segment_path = logger.segmentPath();
+
+    ReusableMessageBuilder builder(256);
+    auto write_idx = [&](int i) {
+      MessageBuilder &msg = builder.reset();
+      auto idx = msg.initEvent().initRoadEncodeIdx();
+      idx.setFrameId(i);
+      idx.setEncodeId(i);
+      idx.setSegmentNum(i);
+      idx.setTimestampEof(i * 50000000ULL);
+      return logger.write(msg, true);
+    };
+
+    // warm up
+    for (int i = 0; i < 100; ++i) msg_size = write_idx(i);
+
+    size_t total_size = 0;
+    count_allocations = true;
+    for (int i = 0; i < iterations; ++i) {
+      total_size += write_idx(i);
+    }
+    count_allocations = false;
+    REQUIRE(heap_allocations == 0);
+    REQUIRE(builder.allocations == 0);
+    REQUIRE(total_size == iterations * msg_size);
+  }
+
+  // the events are framed like messageToFlatArray() output
+  std::string log = zstd_decompress(util::read_file(segment_path + "/rlog.zst"));
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  int idx_count = 0;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    if (event.which() == cereal::Event::ROAD_ENCODE_IDX) {
+      REQUIRE(event.getRoadEncodeIdx().getFrameId() == (idx_count < 100 ? idx_count : idx_count - 100));
+      REQUIRE((reader.getEnd() - words.begin()) * sizeof(capnp::word) == msg_size);
+      ++idx_count;
+    }
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+  REQUIRE(idx_count == 100 + iterations);
+}
@@ -5,6 +5,7 @@ import random
 import string
 import subprocess
 import time
+import warnings
 from collections import defaultdict
 from pathlib import Path
 import pytest
@@ -296,6 +297,63 @@ class TestLoggerd:
     segment_dir = self._get_latest_log_dir()
     assert getxattr(segment_dir, PRESERVE_ATTR_NAME) is None
 
+  @pytest.mark.xdist_group("camera_encoder_tests")  # setting xdist group ensures tests are run in same worker, prevents encoderd from crashing
+  def test_latency_with_all_cameras(self, monkeypatch):
+    # the encoder streams are muxed on their own threads, so large video packets shouldn't hold up other services
+    Params().put_bool("RecordFront", True)
+    monkeypatch.setenv("LOGGERD_TEST", "1")
+    monkeypatch.setenv("LOGGERD_SEGMENT_LENGTH", "60")
+
+    encoder_services = ["roadEncodeData", "wideRoadEncodeData", "driverEncodeData"]
+    probe = "carState"
+    pm = messaging.PubMaster(encoder_services + [probe])
+    managed_processes["loggerd"].start()
+    for s in encoder_services + [probe]:
+      assert pm.wait_for_readers_to_update(s, timeout=5)
+
+    fps, probes_per_frame, seconds = 20, 5, 5
+    packet = os.urandom(512 * 1024)  # about the size of an HEVC keyframe
+    latencies = []
+    for n in range(fps * seconds):
+      for s in encoder_services:
+        m = messaging.new_message(s)
+        edata = getattr(m, s)
+        edata.idx.frameId = n
+        edata.idx.type = 'fullHEVC'
+        edata.idx.timestampEof = int(n * 1e9 / fps)
+        edata.idx.flags = 8  # V4L2_BUF_FLAG_KEYFRAME
+        edata.width, edata.height = 1928, 1208
+        edata.data = packet
+        pm.send(s, m)
+
+      # time until loggerd has read each probe message
+      for _ in range(probes_per_frame):
+        t = time.monotonic()
+        pm.send(probe, messaging.new_message(probe))
+        while not pm.all_readers_updated(probe):
+          time.sleep(0.0002)
+        latencies.append(time.monotonic() - t)
+        time.sleep(1. / (fps * probes_per_frame))
+
+    for s in encoder_services:
+      assert pm.wait_for_readers_to_update(s, timeout=5)
+    managed_processes["loggerd"].stop()
+
+    latencies_ms = np.array(latencies) * 1e3
+    report = f"{probe} latency: p50 {np.percentile(latencies_ms, 50):.2f}ms, p99 {np.percentile(latencies_ms, 99):.2f}ms, max {latencies_ms.max():.2f}ms"
+    print(report)
+    # only reported, the latency depends on the load of the machine running the test
+    if latencies_ms.max() >= 100:
+      warnings.warn(f"slow {report}")
+
+    lr = list(LogReader(os.path.join(self._get_latest_log_dir(), "rlog.zst")))
+    counts = defaultdict(int)
+    for m in lr:
+      counts[m.which()] += 1
+    assert counts[probe] == len(latencies)
+    for s in encoder_services:
+      assert counts[s.replace("Data", "Idx")] == fps * seconds
+
   @pytest.mark.xdist_group("camera_encoder_tests")  # setting xdist group ensures tests are run in same worker, prevents encoderd from crashing
   @pytest.mark.parametrize("record_front", [True, False])
   def test_record_front(self, record_front):
@@ -1,6 +1,7 @@
 #include <zstd.h>
 
 #include <catch2/catch.hpp>
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -42,3 +43,65 @@ TEST_CASE("ZstdFileWriter writes and compresses data correctly in loops", "[Zstd
   // Clean up the test file
   std::remove(filename.c_str());
 }
+
+TEST_CASE("ZstdFileWriter flushes on an interval", "[ZstdFileWriter]") {
+  const std::string filename = "test_zstd_flush.zst";
+  const std::string first = util::random_string(1024);
+  {
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL, 0, {.flush_interval_ms = 10});
+    writer.write((void *)first.data(), first.size());
+    util::sleep_for(20);
+    // the next write is past the interval and pushes both messages out
+    writer.write((void *)first.data(), first.size());
+    std::string flushed;
+    for (int i = 0; i < 500 && flushed.size() < 2 * first.size(); ++i) {
+      util::sleep_for(10);
+      flushed = zstd_decompress(util::read_file(filename));
+    }
+    REQUIRE(flushed == first + first);
+  }
+  REQUIRE(zstd_decompress(util::read_file(filename)) == first + first);
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("ZstdFileWriter writes a seekable log", "[ZstdFileWriter]") {
+  const std::string filename = "test_zstd_seekable.zst";
+  const uint64_t start_ns = 1000000000;
+  std::string totalTestData;
+  {
+    ZstdFileWriter writer(filename, LOG_COMPRESSION_LEVEL);
+    writer.setSeekable(64 * 1024, 100000000);
+    // 10 ms apart, so a new frame every 100 ms, or sooner for the large messages
+    for (int i = 0; i < 200; ++i) {
+      std::string testData = util::random_string(i % 50 == 0 ? 100 * 1024 : 512);
+      totalTestData.append(testData);
+      writer.write(testData.data(), testData.size(), start_ns + i * 10000000ULL, i % 3);
+    }
+  }
+
+  // regular decoders skip the index
+  auto compressedContent = util::read_file(filename);
+  REQUIRE(zstd_decompress(compressedContent) == totalTestData);
+
+  auto frames = zstd_seek::decode_index(compressedContent.data(), compressedContent.size());
+  REQUIRE(frames.size() >= 20);
+  uint64_t next_mono_time = start_ns;
+  for (const auto &f : frames) {
+    INFO("frame at " << f.offset);
+    REQUIRE(f.min_mono_time == next_mono_time);
+    REQUIRE(f.max_mono_time - f.min_mono_time < 100000000);
+    REQUIRE(f.which.count() == std::min<uint64_t>(3, (f.max_mono_time - f.min_mono_time) / 10000000 + 1));
+    next_mono_time = f.max_mono_time + 10000000;
+
+    // every frame decompresses on its own
+    std::string content(f.decompressed_size, '\0');
+    size_t ret = ZSTD_decompress(content.data(), content.size(), compressedContent.data() + f.offset, f.compressed_size);
+    REQUIRE(ret == f.decompressed_size);
+    REQUIRE(content == totalTestData.substr(f.decompressed_offset, f.decompressed_size));
+  }
+  REQUIRE(frames.back().decompressed_offset + frames.back().decompressed_size == totalTestData.size());
+
+  // a log without an index
+  REQUIRE(zstd_seek::decode_index(totalTestData.data(), totalTestData.size()).empty());
+  std::remove(filename.c_str());
+}
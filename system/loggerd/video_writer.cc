@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include "system/loggerd/video_writer.h"
 #include "common/swaglog.h"
@@ -44,8 +46,7 @@ VideoWriter::VideoWriter(const char *path, const char *filename, bool remuxing,
     assert(err >= 0);
 
   } else {
-    this->of = util::safe_fopen(this->vid_path.c_str(), "wb");
-    assert(this->of);
+    this->file = FileWriter::create(this->vid_path, segment_file_options());
   }
 }
 
@@ -86,12 +87,14 @@ void VideoWriter::initialize_audio(int sample_rate) {
   this->audio_frame->nb_samples = this->audio_codec_ctx->frame_size;
   err = av_frame_get_buffer(this->audio_frame, 0);
   assert(err >= 0);
+
+  // up to 10 seconds are buffered until the header is written
+  this->audio_buffer.resize(std::max(sample_rate * 10, this->audio_codec_ctx->frame_size));
 }
 
 void VideoWriter::write(uint8_t *data, int len, long long timestamp, bool codecconfig, bool keyframe) {
-  if (of && data) {
-    size_t written = util::safe_fwrite(data, 1, len, of);
-    if (written != len) {
+  if (file && data) {
+    if (!file->write(data, len)) {
       LOGE("failed to write file.errno=%d", errno);
     }
   }
@@ -147,31 +150,30 @@ void VideoWriter::write_audio(uint8_t *data, int len, long long timestamp, int s
     audio_pts = (timestamp * audio_codec_ctx->sample_rate) / 1000000ULL;
   }
 
-  // convert s16le samples to fltp and add to buffer
   const int16_t *raw_samples = reinterpret_cast<const int16_t*>(data);
-  int sample_count = len / sizeof(int16_t);
-  constexpr float normalizer = 1.0f / 32768.0f;
-
-  const size_t max_buffer_size = sample_rate * 10; // 10 seconds
-  if (audio_buffer.size() + sample_count > max_buffer_size) {
-    size_t samples_to_drop = (audio_buffer.size() + sample_count) - max_buffer_size;
-    LOGE("Audio buffer overflow, dropping %zu oldest samples", samples_to_drop);
-    audio_buffer.erase(audio_buffer.begin(), audio_buffer.begin() + samples_to_drop);
-    audio_pts += samples_to_drop;
+  size_t sample_count = len / sizeof(int16_t);
+  const size_t frame_size = audio_codec_ctx->frame_size;
+
+  if (header_written) {
+    // nothing buffered, convert whole frames straight into the encoder's frame
+    while (audio_buffer.size() == 0 && sample_count >= frame_size) {
+      audio_frame->pts = audio_pts;
+      s16_to_float(raw_samples, reinterpret_cast<float*>(audio_frame->data[0]), frame_size);
+      encode_and_write_audio_frame(audio_frame);
+      raw_samples += frame_size;
+      sample_count -= frame_size;
+    }
+  }
+  // the pts of the oldest buffered sample moves with the samples dropped on overflow
+  if (size_t dropped = audio_buffer.write(raw_samples, sample_count)) {
+    LOGE("Audio buffer overflow, dropping %zu oldest samples", dropped);
+    audio_pts += dropped;
   }
-
-  // Add new samples to the buffer
-  const size_t original_size = audio_buffer.size();
-  audio_buffer.resize(original_size + sample_count);
-  std::transform(raw_samples, raw_samples + sample_count, audio_buffer.begin() + original_size,
-                [](int16_t sample) { return sample * normalizer; });
 
   if (!header_written) return; // header not written yet, process audio frame after header is written
-  while (audio_buffer.size() >= audio_codec_ctx->frame_size) {
+  while (audio_buffer.size() >= frame_size) {
     audio_frame->pts = audio_pts;
-    float *f_samples = reinterpret_cast<float*>(audio_frame->data[0]);
-    std::copy(audio_buffer.begin(), audio_buffer.begin() + audio_codec_ctx->frame_size, f_samples);
-    audio_buffer.erase(audio_buffer.begin(), audio_buffer.begin() + audio_codec_ctx->frame_size);
+    audio_buffer.read(reinterpret_cast<float*>(audio_frame->data[0]), frame_size);
     encode_and_write_audio_frame(audio_frame);
   }
 }
@@ -200,13 +202,15 @@ void VideoWriter::encode_and_write_audio_frame(AVFrame* frame) {
 
 void VideoWriter::process_remaining_audio() {
   // Process remaining audio samples by padding with silence
-  if (audio_buffer.size() > 0 && audio_buffer.size() < audio_codec_ctx->frame_size) {
-    audio_buffer.resize(audio_codec_ctx->frame_size, 0.0f);
+  const size_t frame_size = audio_codec_ctx->frame_size;
+  if (audio_buffer.size() > 0 && audio_buffer.size() < frame_size) {
+    float *f_samples = reinterpret_cast<float *>(audio_frame->data[0]);
+    const size_t remaining = audio_buffer.size();
+    audio_buffer.read(f_samples, remaining);
+    std::fill(f_samples + remaining, f_samples + frame_size, 0.0f);
 
     // Encode final frame
     audio_frame->pts = audio_pts;
-    float *f_samples = reinterpret_cast<float *>(audio_frame->data[0]);
-    std::copy(audio_buffer.begin(), audio_buffer.end(), f_samples);
     encode_and_write_audio_frame(audio_frame);
   }
 }
@@ -226,9 +230,8 @@ VideoWriter::~VideoWriter() {
     if (err != 0) LOGE("avio_closep failed %d", err);
     avformat_free_context(this->ofmt_ctx);
   } else {
-    util::safe_fflush(this->of);
-    fclose(this->of);
-    this->of = nullptr;
+    if (!this->file->close()) LOGE("failed to close %s", this->vid_path.c_str());
+    this->file.reset();
   }
   unlink(this->lock_path.c_str());
 }
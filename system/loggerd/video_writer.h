@@ -1,7 +1,8 @@
 #pragma once
 
+#include <memory>
 #include <string>
-#include <deque>
+#include <vector>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -9,6 +10,8 @@ extern "C" {
 }
 
 #include "cereal/messaging/messaging.h"
+#include "system/loggerd/audio_buffer.h"
+#include "system/loggerd/file_writer.h"
 
 class VideoWriter {
 public:
@@ -24,7 +27,7 @@ private:
   void process_remaining_audio();
 
   std::string vid_path, lock_path;
-  FILE *of = nullptr;
+  std::unique_ptr<FileWriter> file;  // raw stream, when not remuxing
 
   AVCodecContext *codec_ctx;
   AVFormatContext *ofmt_ctx;
@@ -36,7 +39,7 @@ private:
   AVCodecContext *audio_codec_ctx = nullptr;
   AVFrame *audio_frame = nullptr;
   uint64_t audio_pts = 0;
-  std::deque<float> audio_buffer;
+  AudioBuffer audio_buffer;  // samples waiting to be encoded
 
   bool remuxing;
 };
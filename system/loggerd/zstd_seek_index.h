@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Seekable zstd logs are a sequence of independent zstd frames followed by a
+// skippable frame holding this index. Regular zstd decoders decompress the
+// frames back to back and skip the index, so the file stays a normal .zst.
+//
+// index frame: skippable magic (4) | payload size (4) | entries | footer
+// entry:       compressed size (4) | decompressed size (4) | min logMonoTime (8) | max logMonoTime (8) | which bitmask (32)
+// footer:      number of entries (4) | version (1) | index magic (4)
+namespace zstd_seek {
+
+constexpr uint32_t SKIPPABLE_MAGIC = 0x184D2A5E;
+constexpr uint32_t INDEX_MAGIC = 0x4B53504F;  // "OPSK"
+constexpr uint8_t INDEX_VERSION = 1;
+constexpr size_t WHICH_BITS = 256;
+constexpr size_t ENTRY_SIZE = 4 + 4 + 8 + 8 + WHICH_BITS / 8;
+constexpr size_t FOOTER_SIZE = 4 + 1 + 4;
+
+struct FrameInfo {
+  uint64_t offset = 0;               // of the compressed frame in the file, filled in by decode_index
+  uint64_t decompressed_offset = 0;  // of its content in the decompressed log, filled in by decode_index
+  uint32_t compressed_size = 0;
+  uint32_t decompressed_size = 0;
+  uint64_t min_mono_time = std::numeric_limits<uint64_t>::max();
+  uint64_t max_mono_time = 0;
+  std::bitset<WHICH_BITS> which;  // Event::Which values present in the frame
+
+  void add(uint64_t mono_time, int event_which) {
+    if (mono_time > 0) {
+      min_mono_time = std::min(min_mono_time, mono_time);
+      max_mono_time = std::max(max_mono_time, mono_time);
+    }
+    if (event_which >= 0 && event_which < (int)WHICH_BITS) {
+      which.set(event_which);
+    } else {
+      which.set();  // unknown type, never skip this frame
+    }
+  }
+};
+
+inline void put_bytes(std::string &out, const void *src, size_t size) { out.append((const char *)src, size); }
+
+// Returns the complete skippable frame for the index.
+inline std::string encode_index(const std::vector<FrameInfo> &frames) {
+  std::string payload;
+  for (const auto &f : frames) {
+    put_bytes(payload, &f.compressed_size, 4);
+    put_bytes(payload, &f.decompressed_size, 4);
+    put_bytes(payload, &f.min_mono_time, 8);
+    put_bytes(payload, &f.max_mono_time, 8);
+    for (size_t i = 0; i < WHICH_BITS; i += 8) {
+      uint8_t byte = 0;
+      for (size_t b = 0; b < 8; ++b) byte |= f.which[i + b] << b;
+      payload += (char)byte;
+    }
+  }
+  uint32_t count = frames.size();
+  put_bytes(payload, &count, 4);
+  payload += (char)INDEX_VERSION;
+  put_bytes(payload, &INDEX_MAGIC, 4);
+
+  std::string frame;
+  uint32_t payload_size = payload.size();
+  put_bytes(frame, &SKIPPABLE_MAGIC, 4);
+  put_bytes(frame, &payload_size, 4);
+  return frame + payload;
+}
+
+// Reads the index from the end of a seekable log. Returns no frames if there is
+// no valid index, e.g. for logs written as one continuous stream.
+inline std::vector<FrameInfo> decode_index(const char *data, size_t size) {
+  auto read = [data](size_t pos, auto &v) { memcpy(&v, data + pos, sizeof(v)); };
+  if (size < 8 + FOOTER_SIZE) return {};
+
+  uint32_t count, magic;
+  uint8_t version;
+  read(size - 4, magic);
+  read(size - 5, version);
+  read(size - 9, count);
+  if (magic != INDEX_MAGIC || version != INDEX_VERSION) return {};
+
+  const uint64_t payload_size = (uint64_t)count * ENTRY_SIZE + FOOTER_SIZE;
+  if (payload_size + 8 > size) return {};
+  const size_t index_begin = size - payload_size - 8;
+  uint32_t skippable_magic, frame_payload_size;
+  read(index_begin, skippable_magic);
+  read(index_begin + 4, frame_payload_size);
+  if (skippable_magic != SKIPPABLE_MAGIC || frame_payload_size != payload_size) return {};
+
+  std::vector<FrameInfo> frames(count);
+  uint64_t offset = 0, decompressed_offset = 0;
+  for (size_t i = 0, pos = index_begin + 8; i < count; ++i, pos += ENTRY_SIZE) {
+    FrameInfo &f = frames[i];
+    read(pos, f.compressed_size);
+    read(pos + 4, f.decompressed_size);
+    read(pos + 8, f.min_mono_time);
+    read(pos + 16, f.max_mono_time);
+    for (size_t b = 0; b < WHICH_BITS; ++b) {
+      f.which[b] = (data[pos + 24 + b / 8] >> (b % 8)) & 1;
+    }
+    f.offset = offset;
+    f.decompressed_offset = decompressed_offset;
+    offset += f.compressed_size;
+    decompressed_offset += f.decompressed_size;
+  }
+  // the frames must exactly cover the file up to the index
+  if (offset != index_begin) return {};
+  return frames;
+}
+
+} // namespace zstd_seek
@@ -1,65 +1,235 @@
-
 #include "system/loggerd/zstd_writer.h"
 
 #include <cassert>
+#include <cstring>
 
+#include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 
-// Constructor: Initializes compression stream and opens file
-ZstdFileWriter::ZstdFileWriter(const std::string& filename, int compression_level) {
-  // Create the compression stream
-  cstream_ = ZSTD_createCStream();
-  assert(cstream_);
+static void update_max(std::atomic<uint64_t> &max, uint64_t value) {
+  uint64_t prev = max.load(std::memory_order_relaxed);
+  while (value > prev && !max.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {}
+}
+
+// Constructor: Initializes compression context, opens file and starts the pipeline
+ZstdFileWriter::ZstdFileWriter(const std::string& filename, int compression_level, int workers, const FileWriterOptions &file_options) {
+  cctx_ = ZSTD_createCCtx();
+  assert(cctx_);
+
+  size_t ret = ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, compression_level);
+  assert(!ZSTD_isError(ret));
+  if (workers > 0) {
+    ret = ZSTD_CCtx_setParameter(cctx_, ZSTD_c_nbWorkers, workers);
+    if (ZSTD_isError(ret)) {
+      LOGW("zstd built without multithreading, compressing %s on one thread", filename.c_str());
+    } else {
+      // keep the per-worker buffers small, the default job size is 4x the window
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_jobSize, 1 << 20);
+    }
+  }
 
-  size_t initResult = ZSTD_initCStream(cstream_, compression_level);
-  assert(!ZSTD_isError(initResult));
+  input_chunk_size_ = ZSTD_CStreamInSize();
+  for (int i = 0; i < INPUT_CHUNKS; ++i) {
+    Chunk in, out;
+    in.data.resize(input_chunk_size_);
+    out.data.resize(ZSTD_CStreamOutSize());
+    if (i == 0) {
+      input_ = std::move(in);
+    } else {
+      free_inputs_.push(std::move(in));
+    }
+    free_outputs_.push(std::move(out));
+  }
 
-  input_cache_capacity_ = ZSTD_CStreamInSize();
-  input_cache_.reserve(input_cache_capacity_);
-  output_buffer_.resize(ZSTD_CStreamOutSize());
+  file_ = FileWriter::create(filename, file_options);
+  filename_ = filename;
+  flush_interval_ns_ = file_options.flush_interval_ms * 1000000ULL;
+  last_flush_ns_ = nanos_since_boot();
 
-  file_ = util::safe_fopen(filename.c_str(), "wb");
-  assert(file_ != nullptr);
+  compress_thread_ = std::thread(&ZstdFileWriter::compressThread, this);
+  write_thread_ = std::thread(&ZstdFileWriter::writeThread, this);
 }
 
 // Destructor: Finalizes compression and closes file
 ZstdFileWriter::~ZstdFileWriter() {
-  flushCache(true);
-  util::safe_fflush(file_);
+  submitChunk(true, true);
+  compress_thread_.join();
+  write_thread_.join();
 
-  int err = fclose(file_);
-  assert(err == 0);
+  if (!file_->close()) {
+    stats_.write_errors.fetch_add(1, std::memory_order_relaxed);
+    LOGE("failed to close %s, errno=%d", filename_.c_str(), errno);
+  }
 
-  ZSTD_freeCStream(cstream_);
+  ZSTD_freeCCtx(cctx_);
 }
 
-// Compresses and writes data to file
-void ZstdFileWriter::write(void* data, size_t size) {
-  // Add data to the input cache
-  input_cache_.insert(input_cache_.end(), (uint8_t*)data, (uint8_t*)data + size);
+void ZstdFileWriter::setSeekable(size_t max_frame_bytes, uint64_t max_frame_ns) {
+  assert(stats_.bytes_in == 0);
+  seekable_ = true;
+  max_frame_bytes_ = max_frame_bytes;
+  max_frame_ns_ = max_frame_ns;
+}
+
+// Copies data into the current input chunk, handing it to the compression thread once full
+void ZstdFileWriter::write(void* data, size_t size, uint64_t mono_time, int which) {
+  memcpy(beginMessage(size, mono_time, which), data, size);
+  endMessage(size);
+}
+
+// Writes the message in the capnp flat array layout, the same bytes messageToFlatArray() returns.
+void ZstdFileWriter::write(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments, uint64_t mono_time, int which) {
+  // segment count - 1, then the size of each segment in words, padded to a whole word
+  const size_t table_size = (segments.size() / 2 + 1) * sizeof(capnp::word);
+  size_t size = table_size;
+  for (auto &segment : segments) size += segment.asBytes().size();
+
+  char *out = beginMessage(size, mono_time, which);
+  memset(out, 0, table_size);
+  uint32_t value = segments.size() - 1;
+  memcpy(out, &value, sizeof(value));
+  for (size_t i = 0; i < segments.size(); ++i) {
+    value = segments[i].size();
+    memcpy(out + (i + 1) * sizeof(value), &value, sizeof(value));
+  }
 
-  // If the cache is full, compress and write to the file
-  if (input_cache_.size() >= input_cache_capacity_) {
-    flushCache(false);
+  char *pos = out + table_size;
+  for (auto &segment : segments) {
+    memcpy(pos, segment.begin(), segment.asBytes().size());
+    pos += segment.asBytes().size();
   }
+  endMessage(size);
 }
 
-// Compress and flush the input cache to the file
-void ZstdFileWriter::flushCache(bool last_chunk) {
-  ZSTD_inBuffer input = {input_cache_.data(), input_cache_.size(), 0};
-  ZSTD_EndDirective mode = !last_chunk ? ZSTD_e_continue : ZSTD_e_end;
-  int finished = 0;
+// Ends the current frame if needed and returns where the next size bytes go in the input chunk.
+char *ZstdFileWriter::beginMessage(size_t size, uint64_t mono_time, int which) {
+  stats_.bytes_in.fetch_add(size, std::memory_order_relaxed);
+  if (seekable_ && frame_.decompressed_size > 0) {
+    bool frame_full = frame_.decompressed_size >= max_frame_bytes_;
+    bool frame_expired = mono_time > 0 && frame_start_ns_ > 0 && mono_time >= frame_start_ns_ + max_frame_ns_;
+    if (frame_full || frame_expired) {
+      submitChunk(true, false);
+    }
+  }
+  if (frame_start_ns_ == 0) frame_start_ns_ = mono_time;
+  frame_.add(mono_time, which);
+  frame_.decompressed_size += size;
+  if (input_.size + size > input_.data.size()) {
+    input_.data.resize(input_.size + size);
+  }
+  return input_.data.data() + input_.size;
+}
 
-  do {
-    ZSTD_outBuffer output = {output_buffer_.data(), output_buffer_.size(), 0};
-    size_t remaining = ZSTD_compressStream2(cstream_, &output, &input, mode);
-    assert(!ZSTD_isError(remaining));
+void ZstdFileWriter::endMessage(size_t size) {
+  input_.size += size;
+  if (input_.size >= input_chunk_size_) {
+    submitChunk(false, false);
+  } else if (flush_interval_ns_ > 0 && nanos_since_boot() - last_flush_ns_ >= flush_interval_ns_) {
+    submitChunk(false, false, true);
+  }
+}
 
-    size_t written = util::safe_fwrite(output_buffer_.data(), 1, output.pos, file_);
-    assert(written == output.pos);
+void ZstdFileWriter::submitChunk(bool end_frame, bool last, bool flush) {
+  input_.last = last;
+  input_.end_frame = end_frame || last;
+  input_.flush = flush;
+  if (flush) last_flush_ns_ = nanos_since_boot();
+  if (input_.end_frame) {
+    input_.frame = frame_;
+    frame_ = {};
+    frame_start_ns_ = 0;
+  }
+  compress_queue_.push(std::move(input_));
+  update_max(stats_.max_compress_queue, compress_queue_.size());
+  if (last) return;
+
+  if (!free_inputs_.try_pop(input_)) {
+    // every chunk is queued for compression, wait for one to come back
+    uint64_t start = nanos_since_boot();
+    input_ = free_inputs_.pop();
+    uint64_t stall = nanos_since_boot() - start;
+    stats_.stalls.fetch_add(1, std::memory_order_relaxed);
+    stats_.stall_ns.fetch_add(stall, std::memory_order_relaxed);
+    update_max(stats_.max_stall_ns, stall);
+  }
+}
 
-    finished = last_chunk ? (remaining == 0) : (input.pos == input.size);
-  } while (!finished);
+void ZstdFileWriter::compressThread() {
+  util::set_thread_name("zstd_compress");
+
+  Chunk out = free_outputs_.pop();
+  uint64_t frame_compressed = 0;
+  while (true) {
+    Chunk in = compress_queue_.pop();
+    // a seekable log doesn't get an empty frame when it was closed right after a frame ended
+    const bool skip = seekable_ && in.last && in.frame.decompressed_size == 0;
+    ZSTD_inBuffer input = {in.data.data(), in.size, 0};
+    ZSTD_EndDirective mode = in.end_frame ? ZSTD_e_end : in.flush ? ZSTD_e_flush : ZSTD_e_continue;
+
+    bool finished = skip;
+    while (!finished) {
+      ZSTD_outBuffer output = {out.data.data(), out.data.size(), out.size};
+      size_t remaining = ZSTD_compressStream2(cctx_, &output, &input, mode);
+      assert(!ZSTD_isError(remaining));
+      frame_compressed += output.pos - out.size;
+      out.size = output.pos;
+
+      finished = (in.end_frame || in.flush) ? (remaining == 0) : (input.pos == input.size);
+      if (out.size == out.data.size()) {
+        write_queue_.push(std::move(out));
+        update_max(stats_.max_write_queue, write_queue_.size());
+        out = free_outputs_.pop();
+      }
+    }
+
+    if (in.end_frame) {
+      if (seekable_ && !skip) {
+        assert(frame_compressed <= UINT32_MAX);
+        in.frame.compressed_size = frame_compressed;
+        frames_.push_back(in.frame);
+      }
+      frame_compressed = 0;
+    }
+
+    if (in.last) {
+      if (seekable_) {
+        std::string index = zstd_seek::encode_index(frames_);
+        out.data.resize(std::max(out.data.size(), out.size + index.size()));
+        memcpy(out.data.data() + out.size, index.data(), index.size());
+        out.size += index.size();
+      }
+      out.last = true;
+      write_queue_.push(std::move(out));
+      break;
+    }
+    if (in.flush) {
+      // hand the partial output to the writer thread as well
+      out.flush = true;
+      write_queue_.push(std::move(out));
+      out = free_outputs_.pop();
+    }
+    in.size = 0;
+    free_inputs_.push(std::move(in));
+  }
+}
 
-  input_cache_.clear();  // Clear cache after compression
+void ZstdFileWriter::writeThread() {
+  util::set_thread_name("zstd_write");
+
+  while (true) {
+    Chunk out = write_queue_.pop();
+    stats_.bytes_out.fetch_add(out.size, std::memory_order_relaxed);
+    bool ok = file_->write(out.data.data(), out.size);
+    if (ok && out.flush) ok = file_->flush();
+    if (!ok && stats_.write_errors.fetch_add(1, std::memory_order_relaxed) == 0) {
+      // e.g. the disk is full, keep going so loggerd can rotate to the next segment
+      LOGE("failed to write %s, errno=%d", filename_.c_str(), errno);
+    }
+
+    if (out.last) break;
+    out.size = 0;
+    out.flush = false;
+    free_outputs_.push(std::move(out));
+  }
 }
@@ -2,23 +2,86 @@
 
 #include <zstd.h>
 
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
 #include <capnp/common.h>
 
+#include "common/queue.h"
+#include "system/loggerd/file_writer.h"
+#include "system/loggerd/zstd_seek_index.h"
+
+// Backpressure counters, readable from any thread.
+struct ZstdWriterStats {
+  std::atomic<uint64_t> bytes_in = 0;
+  std::atomic<uint64_t> bytes_out = 0;
+  std::atomic<uint64_t> stalls = 0;        // write() calls that waited for a free input buffer
+  std::atomic<uint64_t> stall_ns = 0;      // total time spent waiting
+  std::atomic<uint64_t> max_stall_ns = 0;
+  std::atomic<uint64_t> max_compress_queue = 0;  // input chunks waiting for compression
+  std::atomic<uint64_t> max_write_queue = 0;     // compressed chunks waiting to be written
+  std::atomic<uint64_t> write_errors = 0;        // failed writes of compressed chunks, e.g. ENOSPC
+};
+
+// Compresses into a zstd file on a pipeline of threads: write() copies into an
+// input chunk and hands full chunks to a compression thread, which passes the
+// output on to a writer thread. write() only blocks when all input chunks are
+// waiting for compression. With file_options.flush_interval_ms, write() pushes
+// everything buffered in the pipeline out to the file at least that often.
 class ZstdFileWriter {
 public:
-  ZstdFileWriter(const std::string &filename, int compression_level);
+  // workers > 0 additionally lets zstd split the compression across that many threads
+  ZstdFileWriter(const std::string &filename, int compression_level, int workers = 0, const FileWriterOptions &file_options = {});
   ~ZstdFileWriter();
-  void write(void* data, size_t size);
+  // Makes the file seekable: ends an independent zstd frame once it holds max_frame_bytes
+  // or its messages span max_frame_ns of logMonoTime, and appends a seek index on close.
+  // Must be called before the first write().
+  void setSeekable(size_t max_frame_bytes, uint64_t max_frame_ns);
+  // mono_time and which describe the message for the seek index
+  void write(void* data, size_t size, uint64_t mono_time = 0, int which = -1);
   inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+  // serializes a message from its segments, without flattening it first
+  void write(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments, uint64_t mono_time = 0, int which = -1);
+  inline const ZstdWriterStats &stats() const { return stats_; }
+
+  static constexpr int INPUT_CHUNKS = 8;
 
 private:
-  void flushCache(bool last_chunk);
+  struct Chunk {
+    std::vector<char> data;  // allocated storage, only grows
+    size_t size = 0;
+    bool last = false;
+    bool end_frame = false;
+    bool flush = false;  // compress and write out everything so far
+    zstd_seek::FrameInfo frame;  // of the frame this chunk ends
+  };
+
+  char *beginMessage(size_t size, uint64_t mono_time, int which);
+  void endMessage(size_t size);
+  void submitChunk(bool end_frame, bool last, bool flush = false);
+  void compressThread();
+  void writeThread();
+
+  size_t input_chunk_size_ = 0;
+  Chunk input_;
+  bool seekable_ = false;
+  size_t max_frame_bytes_ = 0;
+  uint64_t max_frame_ns_ = 0;
+  uint64_t frame_start_ns_ = 0;
+  uint64_t flush_interval_ns_ = 0;
+  uint64_t last_flush_ns_ = 0;
+  zstd_seek::FrameInfo frame_;  // of the frame currently being written
+  std::vector<zstd_seek::FrameInfo> frames_;  // finished frames, only used by the compression thread
+  ZSTD_CCtx *cctx_;
+  std::unique_ptr<FileWriter> file_;
+  std::string filename_;
 
-  size_t input_cache_capacity_ = 0;
-  std::vector<char> input_cache_;
-  std::vector<char> output_buffer_;
-  ZSTD_CStream *cstream_;
-  FILE* file_ = nullptr;
+  SpscQueue<Chunk> free_inputs_{INPUT_CHUNKS};
+  SpscQueue<Chunk> compress_queue_{INPUT_CHUNKS};
+  SpscQueue<Chunk> free_outputs_{INPUT_CHUNKS};
+  SpscQueue<Chunk> write_queue_{INPUT_CHUNKS};
+  std::thread compress_thread_;
+  std::thread write_thread_;
+  ZstdWriterStats stats_;
 };
@@ -27,14 +27,11 @@ CameraServer::CameraServer(std::pair<int, int> camera_size[MAX_CAMERAS]) {
 }
 
 CameraServer::~CameraServer() {
+  // The camera threads are the only consumers of their queues, so they skip the
+  // pending frames themselves.
+  exit_ = true;
   for (auto &cam : cameras_) {
     if (cam.thread.joinable()) {
-      // Clear the queue
-      std::pair<FrameReader*, const Event *> item;
-      while (cam.queue.try_pop(item)) {
-        --publishing_;
-      }
-
       // Signal termination and join the thread
       cam.queue.push({});
       cam.thread.join();
@@ -65,6 +62,10 @@ void CameraServer::cameraThread(Camera &cam) {
   while (true) {
     const auto [fr, event] = cam.queue.pop();
     if (!fr) break;
+    if (exit_) {
+      --publishing_;
+      continue;
+    }
 
     capnp::FlatArrayMessageReader reader(event->data);
     auto evt = reader.getRoot<cereal::Event>();
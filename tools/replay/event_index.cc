@@ -0,0 +1,59 @@
+#include "tools/replay/event_index.h"
+
+#include <algorithm>
+#include <utility>
+
+EventIndex::EventIndex(const std::vector<Event> &events) {
+  // the INIT_DATA at the front of each log isn't replayed
+  auto first = events.begin();
+  if (first != events.end() && first->which == cereal::Event::Which::INIT_DATA) ++first;
+
+  events_ = events.data() + (first - events.begin());
+  mono_times_.reserve(events.end() - first);
+  which_.reserve(events.end() - first);
+  for (auto it = first; it != events.end(); ++it) {
+    mono_times_.push_back(it->mono_time);
+    which_.push_back(it->which);
+  }
+}
+
+EventIndex::EventIndex(std::shared_ptr<const std::vector<Event>> events) : EventIndex(*events) {
+  owner_ = std::move(events);
+}
+
+size_t EventIndex::upperBound(uint64_t mono_time, cereal::Event::Which which) const {
+  size_t pos = std::lower_bound(mono_times_.begin(), mono_times_.end(), mono_time) - mono_times_.begin();
+  while (pos < size() && mono_times_[pos] == mono_time && which_[pos] <= which) ++pos;
+  return pos;
+}
+
+EventStream::EventStream(const std::vector<const EventIndex *> &indexes, uint64_t mono_time, cereal::Event::Which which) {
+  heap_.reserve(indexes.size());
+  for (uint32_t i = 0; i < indexes.size(); ++i) {
+    const EventIndex *index = indexes[i];
+    size_t pos = index->upperBound(mono_time, which);
+    if (pos < index->size()) {
+      heap_.push_back({index->monoTime(pos), index->which(pos), i, pos, index});
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), after);
+}
+
+EventStream &EventStream::operator++() {
+  Cursor &top = heap_.front();
+  if (++top.pos == top.index->size()) {
+    std::pop_heap(heap_.begin(), heap_.end(), after);
+    heap_.pop_back();
+    return *this;
+  }
+
+  // the other logs rarely overlap, so the cursor mostly stays on top
+  top.mono_time = top.index->monoTime(top.pos);
+  top.which = top.index->which(top.pos);
+  for (size_t i = 0, child = 1; child < heap_.size(); i = child, child = 2 * i + 1) {
+    if (child + 1 < heap_.size() && after(heap_[child], heap_[child + 1])) ++child;
+    if (!after(heap_[i], heap_[child])) break;
+    std::swap(heap_[i], heap_[child]);
+  }
+  return *this;
+}
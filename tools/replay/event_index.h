@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "tools/replay/logreader.h"
+
+// The sorted events of one log, with their sort keys stored column by column, so
+// that seeking and merging only touch the keys.
+class EventIndex {
+public:
+  // events must be sorted and outlive the index
+  explicit EventIndex(const std::vector<Event> &events);
+  // keeps the events alive
+  explicit EventIndex(std::shared_ptr<const std::vector<Event>> events);
+
+  size_t size() const { return mono_times_.size(); }
+  uint64_t monoTime(size_t i) const { return mono_times_[i]; }
+  cereal::Event::Which which(size_t i) const { return which_[i]; }
+  const Event &event(size_t i) const { return events_[i]; }
+  // Position of the first event after (mono_time, which)
+  size_t upperBound(uint64_t mono_time, cereal::Event::Which which) const;
+
+private:
+  std::shared_ptr<const std::vector<Event>> owner_;
+  const Event *events_ = nullptr;  // events_[i] is the event at mono_times_[i]
+  std::vector<uint64_t> mono_times_;
+  std::vector<cereal::Event::Which> which_;
+};
+
+// Iterates the events of several indexes in time order without merging them. Each
+// index is searched separately, so positioning the stream is O(log n) per index.
+class EventStream {
+public:
+  EventStream() = default;
+  // starts after (mono_time, which)
+  EventStream(const std::vector<const EventIndex *> &indexes, uint64_t mono_time, cereal::Event::Which which);
+
+  bool done() const { return heap_.empty(); }
+  const Event &operator*() const { return heap_.front().index->event(heap_.front().pos); }
+  const Event *operator->() const { return &**this; }
+  EventStream &operator++();
+
+private:
+  struct Cursor {
+    uint64_t mono_time;
+    cereal::Event::Which which;
+    uint32_t source;  // breaks ties in the order of the indexes
+    size_t pos;
+    const EventIndex *index;
+  };
+  // heap order, the earliest cursor is at the front
+  static bool after(const Cursor &a, const Cursor &b) {
+    if (a.mono_time != b.mono_time) return a.mono_time > b.mono_time;
+    if (a.which != b.which) return a.which > b.which;
+    return a.source > b.source;
+  }
+
+  std::vector<Cursor> heap_;
+};
@@ -1,6 +1,8 @@
 #include "tools/replay/filereader.h"
 
-#include <fstream>
+#include <unistd.h>
+
+#include <cstdio>
 
 #include "common/util.h"
 #include "system/hardware/hw.h"
@@ -26,13 +28,24 @@ std::string FileReader::read(const std::string &file, std::atomic<bool> *abort)
   } else if (is_remote) {
     result = download(file, abort);
     if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+      // the cache file may be mapped by another reader, so it's replaced instead of truncated
+      const std::string tmp_file = local_file + ".tmp_" + util::random_string(8);
+      if (util::write_file(tmp_file.c_str(), result.data(), result.size(), O_WRONLY | O_CREAT | O_EXCL, 0644) != 0 ||
+          rename(tmp_file.c_str(), local_file.c_str()) != 0) {
+        rWarning("failed to cache %s", file.c_str());
+        ::unlink(tmp_file.c_str());
+      }
     }
   }
   return result;
 }
 
+std::unique_ptr<MappedMemory> FileReader::map(const std::string &file) {
+  const bool is_remote = file.find("https://") == 0;
+  if (is_remote && !cache_to_local_) return nullptr;
+  return MappedMemory::mapFile(is_remote ? cacheFilePath(file) : file);
+}
+
 std::string FileReader::download(const std::string &url, std::atomic<bool> *abort) {
   for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
     if (i > 0) {
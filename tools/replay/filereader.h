@@ -1,14 +1,19 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <string>
 
+#include "tools/replay/util.h"
+
 class FileReader {
 public:
   FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // Maps a local file, or the cached copy of a remote one. Returns nullptr if there is none.
+  std::unique_ptr<MappedMemory> map(const std::string &file);
 
 private:
   std::string download(const std::string &url, std::atomic<bool> *abort);
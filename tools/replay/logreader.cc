@@ -1,65 +1,241 @@
 #include "tools/replay/logreader.h"
 
 #include <algorithm>
+#include <cstring>
 #include <utility>
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 #include "common/util.h"
 
+// decompressed logs are kept in blocks of this size, events can't span blocks
+constexpr size_t BLOCK_SIZE = 16 * 1024 * 1024;
+// how much is decompressed before the new output is parsed
+constexpr size_t DECODE_STEP = 1024 * 1024;
+// events are logged a little out of order, a later event is never older than this
+constexpr uint64_t REORDER_WINDOW = 1e9;
+// log time before the first on_progress call. the interval doubles after each call
+constexpr uint64_t FIRST_PROGRESS_INTERVAL = 2e9;
+
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  std::string data = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (!data.empty()) {
-    if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
-      data = decompressBZ2(data, abort);
-    } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
-      data = decompressZST(data, abort);
+  // local and cached logs are mapped instead of read, so uncompressed logs are never copied
+  FileReader reader(local_cache, chunk_size, retries);
+  std::unique_ptr<MappedMemory> file = reader.map(url);
+  std::string downloaded;
+  if (!file) {
+    downloaded = reader.read(url, abort);
+    // the download is cached now, continue with the mapped cache file
+    if (!downloaded.empty() && (file = reader.map(url))) downloaded = {};
+  }
+  std::string_view data = file ? std::string_view(file->data(), file->size()) : downloaded;
+  if (data.empty()) return false;
+
+  events.reserve(65000);
+  if (url.find(".bz2") != std::string::npos || data.substr(0, 4) == "BZh9") {
+    decode(*StreamDecompressor::createBZ2(), {data}, abort);
+  } else if (url.find(".zst") != std::string::npos || data.substr(0, 4) == "\x28\xB5\x2F\xFD") {
+    auto frames = zstd_seek::decode_index(data.data(), data.size());
+    const bool seekable = !frames.empty();
+    if (!seekable) {
+      frames = findZSTFrames(data.data(), data.size());
+    } else if (!filters_.empty()) {
+      // no selected frames means none of the filtered events are in the log
+      frames = selectFrames(frames);
     }
+    if (frames.size() > 1) {
+      decodeFrames(data, frames, abort);
+    } else if (frames.size() == 1) {
+      decode(*StreamDecompressor::createZST(), {data.substr(frames[0].offset, frames[0].compressed_size)}, abort);
+    } else if (!seekable) {
+      // the frame sizes are unknown
+      decode(*StreamDecompressor::createZST(), {data}, abort);
+    }
+  } else if (file) {
+    // the events point into the mapping
+    file_ = std::move(file);
+    return load(file_->data(), file_->size(), abort);
+  } else {
+    raw_ = std::move(downloaded);
+    return load(raw_.data(), raw_.size(), abort);
   }
+  return finish(abort);
+}
+
+// Keeps the frames of a seekable log that contain any of the filtered event types.
+std::vector<zstd_seek::FrameInfo> LogReader::selectFrames(const std::vector<zstd_seek::FrameInfo> &frames) {
+  std::bitset<zstd_seek::WHICH_BITS> wanted;
+  for (size_t i = 0; i < filters_.size() && i < wanted.size(); ++i) wanted[i] = filters_[i];
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort);
-  if (filters_.empty())
-    raw_ = std::move(data);
-  return success;
+  std::vector<zstd_seek::FrameInfo> selected;
+  for (const auto &f : frames) {
+    // skipped frames may contain selfdriveState, which decides about the migration
+    if (f.which[cereal::Event::SELFDRIVE_STATE]) requires_migration = false;
+    if ((f.which & wanted).any()) selected.push_back(f);
+  }
+  return selected;
 }
 
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
+  events.reserve(65000);
   try {
-    events.reserve(65000);
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
-    while (words.size() > 0 && !(abort && *abort)) {
-      capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
-      auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
-      words = kj::arrayPtr(reader.getEnd(), words.end());
-      if (which == cereal::Event::Which::SELFDRIVE_STATE) {
-        requires_migration = false;
-      }
-
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
-      }
+    size_t parsed = parse(data, size, abort);
+    if (parsed != size && !(abort && *abort)) {
+      rWarning("Failed to parse log : truncated message.\nRetrieved %zu events from corrupt log", events.size());
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
+  }
+  if (!filters_.empty()) {
+    // the filtered events are copied
+    raw_ = {};
+    file_.reset();
+  }
+  return finish(abort);
+}
 
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+// Decompresses the log block by block and parses the events as soon as they are complete.
+void LogReader::decode(StreamDecompressor &decompressor, const std::vector<std::string_view> &input, std::atomic<bool> *abort) {
+  char *block = nullptr;
+  size_t capacity = 0, begin = 0, end = 0;  // [begin, end) of the block is decompressed but not parsed yet
+  try {
+    for (std::string_view in : input) {
+      while (!(abort && *abort)) {
+        if (end == capacity) {
+          // continue with the incomplete event in a new block. filtered events are copied,
+          // so their block is reused as long as it's big enough.
+          const size_t tail = end - begin;
+          if (!block || filters_.empty() || tail > capacity / 2) {
+            auto new_block = MappedMemory::allocate(std::max(BLOCK_SIZE, tail * 2));
+            if (tail > 0) memcpy(new_block->data(), block + begin, tail);
+            if (!filters_.empty()) {
+              blocks_.clear();
+            } else if (block) {
+              // the incomplete event moved to the new block
+              blocks_.back()->release(begin, capacity - begin);
+            }
+            block = new_block->data();
+            capacity = new_block->size();
+            blocks_.push_back(std::move(new_block));
+          } else {
+            memmove(block, block + begin, tail);
+          }
+          begin = 0;
+          end = tail;
         }
+
+        ssize_t size = decompressor.decompress(in, block + end, std::min(capacity - end, DECODE_STEP));
+        if (size < 0) return;
+        if (size == 0) break;
+
+        end += size;
+        begin += parse(block + begin, end - begin, abort);
+        updateProgress();
       }
     }
+    if (begin != end && !(abort && *abort)) {
+      rWarning("Failed to parse log : truncated message.\nRetrieved %zu events from corrupt log", events.size());
+    }
   } catch (const kj::Exception &e) {
     rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
+}
+
+// Decompresses zstd frames of known size concurrently into one block, and parses the
+// events in order as the frames are done.
+void LogReader::decodeFrames(std::string_view data, const std::vector<zstd_seek::FrameInfo> &frames, std::atomic<bool> *abort) {
+  size_t total_size = 0;
+  for (const auto &f : frames) total_size += f.decompressed_size;
+  if (total_size == 0) return;
+
+  char *block = blocks_.emplace_back(MappedMemory::allocate(total_size))->data();
+  size_t parsed = 0;
+  std::string error;
+  size_t size = decompressZSTFrames(data.data(), data.size(), frames, block, [&](size_t ready) {
+    try {
+      parsed += parse(block + parsed, ready - parsed, abort);
+      updateProgress();
+      return true;
+    } catch (const kj::Exception &e) {
+      error = e.getDescription().cStr();
+      return false;
+    }
+  }, abort);
+
+  if (!error.empty()) {
+    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", error.c_str(), events.size());
+  } else if (parsed != size && !(abort && *abort)) {
+    rWarning("Failed to parse log : truncated message.\nRetrieved %zu events from corrupt log", events.size());
+  }
+}
+
+// Parses the complete events at the front of data and returns their size.
+size_t LogReader::parse(const char *data, size_t size, std::atomic<bool> *abort) {
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+  while (words.size() > 0 && capnp::expectedSizeInWordsFromPrefix(words) <= words.size() && !(abort && *abort)) {
+    capnp::FlatArrayMessageReader reader(words);
+    auto event = reader.getRoot<cereal::Event>();
+    auto which = event.which();
+    auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+    if (which == cereal::Event::Which::SELFDRIVE_STATE) {
+      requires_migration = false;
+    }
+
+    if (!filters_.empty()) {
+      if (which >= filters_.size() || !filters_[which])
+        continue;
+      auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+      memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+      event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+    }
+
+    uint64_t mono_time = event.getLogMonoTime();
+    max_mono_time_ = std::max(max_mono_time_, mono_time);
+    const Event &evt = events.emplace_back(which, mono_time, event_data);
+    // Add encodeIdx packet again as a frame packet for the video stream
+    if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
+        evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
+        evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+      auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+      if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+        uint64_t sof = idx.getTimestampSof();
+        events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+      }
+    }
+  }
+  return (const char *)words.begin() - data;
+}
+
+// Sorts the events that are older than anything still to come and hands them to on_progress.
+void LogReader::updateProgress() {
+  if (!on_progress || max_mono_time_ < REORDER_WINDOW) return;
+
+  if (next_progress_time_ == 0) {
+    progress_interval_ = FIRST_PROGRESS_INTERVAL;
+    next_progress_time_ = max_mono_time_ + progress_interval_;
+  }
+  if (max_mono_time_ < next_progress_time_) return;
+
+  // events = [sorted | not sorted yet]
+  const uint64_t settled_time = max_mono_time_ - REORDER_WINDOW;
+  auto first = events.begin() + sorted_count_;
+  auto last = std::partition(first, events.end(), [=](const Event &e) { return e.mono_time <= settled_time; });
+  std::sort(first, last);
+  if (first != events.begin() && first != last && *first < *std::prev(first)) {
+    std::inplace_merge(events.begin(), first, last);
+  }
+  sorted_count_ = last - events.begin();
+
+  progress_interval_ *= 2;
+  next_progress_time_ = max_mono_time_ + progress_interval_;
+  if (sorted_count_ > 0) {
+    on_progress(events, sorted_count_);
+  }
+}
+
+bool LogReader::finish(std::atomic<bool> *abort) {
+  if (!filters_.empty()) {
+    blocks_.clear();
+  }
 
   if (requires_migration) {
     migrateOldEvents();
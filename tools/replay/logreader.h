@@ -1,5 +1,7 @@
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -32,11 +34,28 @@ public:
   bool load(const char *data, size_t size, std::atomic<bool> *abort = nullptr);
   std::vector<Event> events;
 
+  // Called on the loading thread while the log is decoded. The first count events are
+  // sorted and no older event is expected, apart from the ones added by the migration.
+  std::function<void(const std::vector<Event> &events, size_t count)> on_progress = nullptr;
+
 private:
+  void decode(StreamDecompressor &decompressor, const std::vector<std::string_view> &input, std::atomic<bool> *abort);
+  void decodeFrames(std::string_view data, const std::vector<zstd_seek::FrameInfo> &frames, std::atomic<bool> *abort);
+  size_t parse(const char *data, size_t size, std::atomic<bool> *abort);
+  void updateProgress();
+  bool finish(std::atomic<bool> *abort);
   void migrateOldEvents();
+  std::vector<zstd_seek::FrameInfo> selectFrames(const std::vector<zstd_seek::FrameInfo> &frames);
 
   std::string raw_;
+  std::unique_ptr<MappedMemory> file_;  // uncompressed log file, the events point into it
+  std::vector<std::unique_ptr<MappedMemory>> blocks_;  // decompressed log, the events point into it
   bool requires_migration = true;
   std::vector<bool> filters_;
   MonotonicBuffer buffer_{1024 * 1024};
+
+  size_t sorted_count_ = 0;
+  uint64_t max_mono_time_ = 0;
+  uint64_t next_progress_time_ = 0;
+  uint64_t progress_interval_ = 0;
 };
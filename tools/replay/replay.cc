@@ -119,7 +119,7 @@ void Replay::seekTo(double seconds, bool relative) {
 }
 
 void Replay::checkSeekProgress() {
-  if (!seg_mgr_->getEventData()->isSegmentLoaded(current_segment_.load())) return;
+  if (!seg_mgr_->getEventData()->hasSegmentEvents(current_segment_.load())) return;
 
   double seek_to = seeking_to_.exchange(-1.0, std::memory_order_acquire);
   if (seek_to >= 0 && onSeekedTo) {
@@ -150,8 +150,15 @@ void Replay::handleSegmentMerge() {
   if (exit_) return;
 
   auto event_data = seg_mgr_->getEventData();
-  if (!stream_thread_.joinable() && !event_data->segments.empty()) {
-    startStream(event_data->segments.begin()->second);
+  if (!stream_thread_.joinable()) {
+    // the first segment may still be loading its log, it's played from the events merged so far
+    SegmentMap segments = event_data->segments;
+    segments.insert(event_data->partial_segments.begin(), event_data->partial_segments.end());
+    if (!segments.empty()) {
+      const auto &[n, segment] = *segments.begin();
+      const bool partial = !event_data->isSegmentLoaded(n);
+      startStream(segment, partial ? *event_data->partial_events : segment->log->events);
+    }
   }
   notifyEvent(onSegmentsMerged);
 
@@ -160,8 +167,11 @@ void Replay::handleSegmentMerge() {
   checkSeekProgress();
 }
 
-void Replay::startStream(const std::shared_ptr<Segment> segment) {
-  const auto &events = segment->log->events;
+void Replay::startStream(const std::shared_ptr<Segment> segment, const std::vector<Event> &events) {
+  if (events.empty()) {
+    rWarning("no events in segment %d", segment->seg_num);
+    return;
+  }
   route_start_ts_ = events.front().mono_time;
   cur_mono_time_ += route_start_ts_ - 1;
 
@@ -241,9 +251,8 @@ void Replay::publishFrame(const Event *e) {
   if ((cam == DriverCam && !hasFlag(REPLAY_FLAG_DCAM)) || (cam == WideRoadCam && !hasFlag(REPLAY_FLAG_ECAM)))
     return;  // Camera isdisabled
 
-  auto seg_it = event_data_->segments.find(e->eidx_segnum);
-  if (seg_it != event_data_->segments.end()) {
-    if (auto &frame = seg_it->second->frames[cam]; frame) {
+  if (auto segment = event_data_->findSegment(e->eidx_segnum)) {
+    if (auto &frame = segment->frames[cam]; frame) {
       camera_server_->pushFrame(cam, frame.get(), e);
     }
   }
@@ -258,22 +267,21 @@ void Replay::streamThread() {
     if (exit_) break;
 
     event_data_ = seg_mgr_->getEventData();
-    const auto &events = event_data_->events;
-    auto first = std::upper_bound(events.cbegin(), events.cend(), Event(cur_which_, cur_mono_time_, {}));
-    if (first == events.cend()) {
+    EventStream stream = event_data_->eventsAfter(cur_mono_time_, cur_which_);
+    if (stream.done()) {
       rInfo("waiting for events...");
       events_ready_ = false;
       continue;
     }
 
-    auto it = publishEvents(first, events.cend());
+    publishEvents(stream);
 
     // Ensure frames are sent before unlocking to prevent race conditions
     if (camera_server_) {
       camera_server_->waitForSent();
     }
 
-    if (it == events.cend() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
+    if (stream.done() && !hasFlag(REPLAY_FLAG_NO_LOOP)) {
       int last_segment = seg_mgr_->route_.segments().rbegin()->first;
       if (event_data_->isSegmentLoaded(last_segment)) {
         rInfo("reaches the end of route, restart from beginning");
@@ -285,14 +293,13 @@ void Replay::streamThread() {
   }
 }
 
-std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::const_iterator first,
-                                                         std::vector<Event>::const_iterator last) {
+void Replay::publishEvents(EventStream &stream) {
   uint64_t evt_start_ts = cur_mono_time_;
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
 
-  for (; !interrupt_requested_ && first != last; ++first) {
-    const Event &evt = *first;
+  for (; !interrupt_requested_ && !stream.done(); ++stream) {
+    const Event &evt = *stream;
 
     int segment = toSeconds(evt.mono_time) / 60;
     if (current_segment_.load(std::memory_order_relaxed) != segment) {
@@ -331,6 +338,4 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
       publishFrame(&evt);
     }
   }
-
-  return first;
 }
@@ -40,6 +40,7 @@ public:
   inline bool isPaused() const { return user_paused_; }
   inline int segmentCacheLimit() const { return seg_mgr_->segment_cache_limit_; }
   inline void setSegmentCacheLimit(int n) { seg_mgr_->segment_cache_limit_ = std::max(MIN_SEGMENTS_CACHE, n); }
+  inline void setMaxConcurrentLoads(int n) { seg_mgr_->max_concurrent_loads_ = std::max(1, n); }
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   void setLoop(bool loop) { loop ? flags_ &= ~REPLAY_FLAG_NO_LOOP : flags_ |= REPLAY_FLAG_NO_LOOP; }
   bool loop() const { return !(flags_ & REPLAY_FLAG_NO_LOOP); }
@@ -50,7 +51,10 @@ public:
   inline double toSeconds(uint64_t mono_time) const { return (mono_time - route_start_ts_) / 1e9; }
   inline double minSeconds() const { return min_seconds_; }
   inline double maxSeconds() const { return max_seconds_; }
-  inline void setSpeed(float speed) { speed_ = speed; }
+  inline void setSpeed(float speed) {
+    speed_ = speed;
+    seg_mgr_->setPlaybackSpeed(speed);
+  }
   inline float getSpeed() const { return speed_; }
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
   inline const std::shared_ptr<std::vector<Timeline::Entry>> getTimeline() const { return timeline_.getEntries(); }
@@ -67,12 +71,11 @@ public:
 private:
   void setupServices(const std::vector<std::string> &allow, const std::vector<std::string> &block);
   void setupSegmentManager(bool has_filters);
-  void startStream(const std::shared_ptr<Segment> segment);
+  void startStream(const std::shared_ptr<Segment> segment, const std::vector<Event> &events);
   void streamThread();
   void handleSegmentMerge();
   void interruptStream(const std::function<bool()>& update_fn);
-  std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
-                                                   std::vector<Event>::const_iterator last);
+  void publishEvents(EventStream &stream);
   void publishMessage(const Event *e);
   void publishFrame(const Event *e);
   void checkSeekProgress();
@@ -4,6 +4,7 @@
 #include <filesystem>
 #include <regex>
 
+#include "common/timing.h"
 #include "third_party/json11/json11.hpp"
 #include "system/hardware/hw.h"
 #include "tools/replay/api.h"
@@ -192,8 +193,9 @@ void Route::addFileToSegment(int n, const std::string &file) {
 // class Segment
 
 Segment::Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters,
-                 std::function<void(int, bool)> callback)
-    : seg_num(n), flags(flags), filters_(filters), on_load_finished_(callback) {
+                 std::function<void(int, bool)> callback, std::function<void(int)> progress_callback, bool log_first)
+    : seg_num(n), flags(flags), filters_(filters), on_load_finished_(callback), on_load_progress_(progress_callback) {
+  load_start_time_ = millis_since_boot();
   // [RoadCam, DriverCam, WideRoadCam, log]. fallback to qcamera/qlog
   const std::array file_list = {
       (flags & REPLAY_FLAG_QCAMERA) || files.road_cam.empty() ? files.qcamera : files.road_cam,
@@ -201,10 +203,16 @@ Segment::Segment(int n, const SegmentFile &files, uint32_t flags, const std::vec
       flags & REPLAY_FLAG_ECAM ? files.wide_road_cam : "",
       files.rlog.empty() ? files.qlog : files.rlog,
   };
+  log_first = log_first && !file_list[MAX_CAMERAS].empty();
   for (int i = 0; i < file_list.size(); ++i) {
     if (!file_list[i].empty() && (!(flags & REPLAY_FLAG_NO_VIPC) || i >= MAX_CAMERAS)) {
       ++loading_;
-      threads_.emplace_back(&Segment::loadFile, this, i, file_list[i]);
+      if (i < MAX_CAMERAS) ++frames_loading_;
+      if (log_first && i < MAX_CAMERAS) {
+        deferred_files_.emplace_back(i, file_list[i]);
+      } else {
+        threads_.emplace_back(&Segment::loadFile, this, i, file_list[i]);
+      }
     }
   }
 }
@@ -213,6 +221,7 @@ Segment::~Segment() {
   {
     std::lock_guard lock(mutex_);
     on_load_finished_ = nullptr;  // Prevent callback after destruction
+    on_load_progress_ = nullptr;
   }
   abort_ = true;
   for (auto &thread : threads_) {
@@ -222,13 +231,29 @@ Segment::~Segment() {
 
 void Segment::loadFile(int id, const std::string file) {
   const bool local_cache = !(flags & REPLAY_FLAG_NO_FILE_CACHE);
+  const double start_time = millis_since_boot();
   bool success = false;
   if (id < MAX_CAMERAS) {
     frames[id] = std::make_unique<FrameReader>();
     success = frames[id]->load((CameraType)id, file, flags & REPLAY_FLAG_NO_HW_DECODER, &abort_, local_cache, 20 * 1024 * 1024, 3);
+    --frames_loading_;
   } else {
     log = std::make_unique<LogReader>(filters_);
+    log->on_progress = [this](const std::vector<Event> &events, size_t count) {
+      // the events can be played once the frames are ready
+      if (frames_loading_ > 0 || abort_) return;
+
+      auto partial = std::make_shared<const std::vector<Event>>(events.begin(), events.begin() + count);
+      std::lock_guard lock(mutex_);
+      partial_events_ = partial;
+      if (on_load_progress_) {
+        on_load_progress_(seg_num);
+      }
+    };
     success = log->load(file, &abort_, local_cache, 0, 3);
+    if (success) {
+      index = std::make_shared<const EventIndex>(log->events);
+    }
   }
 
   if (!success) {
@@ -236,16 +261,58 @@ void Segment::loadFile(int id, const std::string file) {
     abort_ = true;
   }
 
+  {
+    std::lock_guard lock(mutex_);
+    const double secs = (millis_since_boot() - start_time) / 1000.0;
+    if (id < MAX_CAMERAS) {
+      load_stats_.video_secs = std::max(load_stats_.video_secs, secs);
+    } else {
+      load_stats_.log_secs = secs;
+    }
+  }
+  if (id == MAX_CAMERAS && !deferred_files_.empty()) {
+    loadDeferredFiles();
+  }
+
   if (--loading_ == 0) {
     std::lock_guard lock(mutex_);
+    load_stats_.total_secs = (millis_since_boot() - load_start_time_) / 1000.0;
     load_state_ = !abort_ ? LoadState::Loaded : LoadState::Failed;
+    partial_events_.reset();
     if (on_load_finished_) {
       on_load_finished_(seg_num, !abort_);
     }
   }
 }
 
+// Loads the video after the log, on threads owned by the log's thread.
+void Segment::loadDeferredFiles() {
+  std::vector<std::thread> threads;
+  for (const auto &[id, file] : deferred_files_) {
+    if (abort_) {
+      // the log failed or the segment was cancelled
+      --frames_loading_;
+      --loading_;
+    } else {
+      threads.emplace_back(&Segment::loadFile, this, id, file);
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+Segment::LoadStats Segment::getLoadStats() {
+  std::scoped_lock lock(mutex_);
+  return load_stats_;
+}
+
 Segment::LoadState Segment::getState() {
   std::scoped_lock lock(mutex_);
   return load_state_;
 }
+
+std::shared_ptr<const std::vector<Event>> Segment::partialEvents() {
+  std::scoped_lock lock(mutex_);
+  return partial_events_;
+}
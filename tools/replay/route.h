@@ -8,6 +8,7 @@
 #include <thread>
 #include <vector>
 
+#include "tools/replay/event_index.h"
 #include "tools/replay/framereader.h"
 #include "tools/replay/logreader.h"
 #include "tools/replay/util.h"
@@ -70,24 +71,44 @@ protected:
 class Segment {
 public:
   enum class LoadState {Loading, Loaded, Failed};
+  struct LoadStats {
+    double log_secs = 0;    // time to load the log
+    double video_secs = 0;  // time to load the slowest camera
+    double total_secs = 0;  // from the start until the segment was loaded
+  };
 
+  // With log_first, the video starts loading once the log is done instead of along with it.
   Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters,
-          std::function<void(int, bool)> callback);
+          std::function<void(int, bool)> callback, std::function<void(int)> progress_callback = nullptr,
+          bool log_first = false);
   ~Segment();
   LoadState getState();
+  LoadStats getLoadStats();
+  // Aborts loading without waiting for it, the segment fails once its loads have stopped.
+  void cancel() { abort_ = true; }
+  // While only the log is still loading, the sorted events decoded so far. nullptr otherwise.
+  std::shared_ptr<const std::vector<Event>> partialEvents();
 
   const int seg_num = 0;
   std::unique_ptr<LogReader> log;
+  std::shared_ptr<const EventIndex> index;  // of the loaded log
   std::unique_ptr<FrameReader> frames[MAX_CAMERAS] = {};
 
 protected:
   void loadFile(int id, const std::string file);
+  void loadDeferredFiles();
 
   std::atomic<bool> abort_ = false;
   std::atomic<int> loading_ = 0;
+  std::atomic<int> frames_loading_ = 0;
   std::mutex mutex_;
   std::vector<std::thread> threads_;
   std::function<void(int, bool)> on_load_finished_ = nullptr;
+  std::function<void(int)> on_load_progress_ = nullptr;
+  std::shared_ptr<const std::vector<Event>> partial_events_;
+  std::vector<std::pair<int, std::string>> deferred_files_;  // loaded after the log
+  double load_start_time_ = 0;
+  LoadStats load_stats_;
   uint32_t flags;
   std::vector<bool> filters_;
   LoadState load_state_  = LoadState::Loading;
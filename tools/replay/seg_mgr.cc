@@ -1,6 +1,7 @@
 #include "tools/replay/seg_mgr.h"
 
 #include <algorithm>
+#include <cmath>
 
 SegmentManager::~SegmentManager() {
   {
@@ -38,12 +39,29 @@ void SegmentManager::setCurrentSegment(int seg_num) {
     std::unique_lock lock(mutex_);
     if (cur_seg_num_ == seg_num) return;
 
+    direction_ = cur_seg_num_ == -1 || seg_num > cur_seg_num_ ? 1 : -1;
     cur_seg_num_ = seg_num;
     needs_update_ = true;
   }
   cv_.notify_one();
 }
 
+void SegmentManager::setPlaybackSpeed(float speed) {
+  {
+    std::unique_lock lock(mutex_);
+    if (playback_speed_ == speed) return;
+
+    playback_speed_ = speed;
+    needs_update_ = true;
+  }
+  cv_.notify_one();
+}
+
+std::map<int, Segment::LoadStats> SegmentManager::getLoadStats() {
+  std::unique_lock lock(mutex_);
+  return load_stats_;
+}
+
 void SegmentManager::manageSegmentCache() {
   while (true) {
     std::unique_lock lock(mutex_);
@@ -54,19 +72,31 @@ void SegmentManager::manageSegmentCache() {
     auto cur = segments_.lower_bound(cur_seg_num_);
     if (cur == segments_.end()) continue;
 
-    // Calculate the range of segments to load
-    auto begin = std::prev(cur, std::min<int>(segment_cache_limit_ / 2, std::distance(segments_.begin(), cur)));
-    auto end = std::next(begin, std::min<int>(segment_cache_limit_, std::distance(begin, segments_.end())));
-    begin = std::prev(end, std::min<int>(segment_cache_limit_, std::distance(segments_.begin(), end)));
+    const std::vector<int> order = prefetchOrder(segments_, cur->first, direction_, playback_speed_, avg_load_secs_,
+                                                 segment_cache_limit_);
+    auto [min_seg, max_seg] = std::minmax_element(order.begin(), order.end());
+    auto begin = segments_.find(*min_seg);
+    auto end = std::next(segments_.find(*max_seg));
 
     lock.unlock();
 
-    loadSegmentsInRange(begin, cur, end);
+    loadSegments(order);
     bool merged = mergeSegments(begin, end);
 
-    // Free segments outside the current range
-    std::for_each(segments_.begin(), begin, [](auto &segment) { segment.second.reset(); });
-    std::for_each(end, segments_.end(), [](auto &segment) { segment.second.reset(); });
+    // Free segments outside the current range. The ones still loading are cancelled, and
+    // released once their loads have stopped, so a seek doesn't wait for them.
+    auto release = [this](auto &segment) {
+      if (segment.second && segment.second->getState() == Segment::LoadState::Loading) {
+        segment.second->cancel();
+        cancelled_.push_back(std::move(segment.second));
+      }
+      segment.second.reset();
+    };
+    std::for_each(segments_.begin(), begin, release);
+    std::for_each(end, segments_.end(), release);
+    cancelled_.erase(std::remove_if(cancelled_.begin(), cancelled_.end(), [](auto &segment) {
+      return segment->getState() != Segment::LoadState::Loading;
+    }), cancelled_.end());
 
     if (merged && onSegmentMergedCallback_) {
       onSegmentMergedCallback_();  // Notify listener that segments have been merged
@@ -74,67 +104,110 @@ void SegmentManager::manageSegmentCache() {
   }
 }
 
+// The order is cur, the ones ahead in the direction of the last move, then the ones behind.
+// Enough segments are kept ahead to play while the next one loads at the playback speed.
+std::vector<int> SegmentManager::prefetchOrder(const SegmentMap &segments, int cur_seg_num, int direction,
+                                               float playback_speed, double avg_load_secs, int cache_limit) {
+  const auto cur = segments.find(cur_seg_num);
+  std::vector<int> forward, backward;
+  for (auto it = std::next(cur); it != segments.end() && (int)forward.size() + 1 < cache_limit; ++it) {
+    forward.push_back(it->first);
+  }
+  for (auto it = cur; it != segments.begin() && (int)backward.size() + 1 < cache_limit;) {
+    backward.push_back((--it)->first);
+  }
+  const auto &ahead = direction > 0 ? forward : backward;
+  const auto &behind = direction > 0 ? backward : forward;
+
+  const int segments_per_load = std::ceil(avg_load_secs * playback_speed / 60.0);
+  const int max_ahead = std::clamp(segments_per_load + 1, cache_limit / 2, cache_limit - 1);
+  const size_t num_behind = std::min<size_t>(cache_limit - 1 - std::min<size_t>(max_ahead, ahead.size()), behind.size());
+  const size_t num_ahead = std::min<size_t>(cache_limit - 1 - num_behind, ahead.size());
+
+  std::vector<int> order = {cur->first};
+  order.insert(order.end(), ahead.begin(), ahead.begin() + num_ahead);
+  order.insert(order.end(), behind.begin(), behind.begin() + num_behind);
+  return order;
+}
+
+// Starts loading the segments in order, with at most max_concurrent_loads_ of them loading at once.
+// Cancelled segments count until their loads have stopped.
+void SegmentManager::loadSegments(const std::vector<int> &order) {
+  auto on_update = [this](int seg_num) {
+    std::unique_lock lock(mutex_);
+    needs_update_ = true;
+    cv_.notify_one();
+  };
+
+  const int max_loads = max_concurrent_loads_;
+  int loading = std::count_if(cancelled_.begin(), cancelled_.end(), [](auto &segment) {
+    return segment->getState() == Segment::LoadState::Loading;
+  });
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto &segment = segments_.at(order[i]);
+    if (!segment) {
+      if (loading >= max_loads) break;
+
+      // the current segment loads everything at once to start playing soon. the others load
+      // their log first, it's needed to merge them and much smaller than the video.
+      segment = std::make_shared<Segment>(
+          order[i], route_.at(order[i]), flags_, filters_,
+          [on_update](int seg_num, bool success) { on_update(seg_num); }, on_update, i > 0);
+    }
+
+    const auto state = segment->getState();
+    if (state == Segment::LoadState::Loading) {
+      ++loading;
+      continue;
+    }
+
+    // the segment locks its mutex before calling back into ours, so don't hold ours while asking it
+    const auto stats = segment->getLoadStats();
+    std::unique_lock lock(mutex_);
+    if (load_stats_.emplace(order[i], stats).second && state == Segment::LoadState::Loaded) {
+      avg_load_secs_ = avg_load_secs_ > 0 ? avg_load_secs_ * 0.7 + stats.total_secs * 0.3 : stats.total_secs;
+      rDebug("segment %d loaded in %.2f s (log %.2f s, video %.2f s)", order[i], stats.total_secs, stats.log_secs,
+             stats.video_secs);
+    }
+  }
+}
+
 bool SegmentManager::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
   std::set<int> segments_to_merge;
-  size_t total_event_count = 0;
+  std::pair<int, std::shared_ptr<const std::vector<Event>>> partial = {-1, nullptr};
   for (auto it = begin; it != end; ++it) {
     const auto &segment = it->second;
-    if (segment && segment->getState() == Segment::LoadState::Loaded) {
+    if (!segment) continue;
+
+    if (segment->getState() == Segment::LoadState::Loaded) {
       segments_to_merge.insert(segment->seg_num);
-      total_event_count += segment->log->events.size();
+    } else if (auto events = segment->partialEvents()) {
+      // Play the segment while its log is loading. Later segments wait until it's
+      // complete, otherwise the stream would skip over the rest of it.
+      partial = {segment->seg_num, events};
+      break;
     }
   }
 
-  if (segments_to_merge == merged_segments_) return false;
+  if (segments_to_merge == merged_segments_ && partial.second == merged_partial_events_) return false;
 
+  // the segments keep their indexes, only the stream has to merge them
   auto merged_event_data = std::make_shared<EventData>();
-  auto &merged_events = merged_event_data->events;
-  merged_events.reserve(total_event_count);
-
   rDebug("merging segments: %s", join(segments_to_merge, ", ").c_str());
   for (int n : segments_to_merge) {
-    const auto &events = segments_.at(n)->log->events;
-    if (events.empty()) continue;
-
-    // Skip INIT_DATA if present
-    auto events_begin = (events.front().which == cereal::Event::Which::INIT_DATA) ? std::next(events.begin()) : events.begin();
-
-    size_t previous_size = merged_events.size();
-    merged_events.insert(merged_events.end(), events_begin, events.end());
-    std::inplace_merge(merged_events.begin(), merged_events.begin() + previous_size, merged_events.end());
-
-    merged_event_data->segments[n] = segments_.at(n);
+    const auto &segment = segments_.at(n);
+    merged_event_data->indexes.push_back(segment->index);
+    merged_event_data->segments[n] = segment;
+  }
+  if (auto &[n, events] = partial; events) {
+    merged_event_data->indexes.push_back(std::make_shared<const EventIndex>(events));
+    merged_event_data->partial_segments[n] = segments_.at(n);
+    merged_event_data->partial_events = events;
   }
 
   std::atomic_store(&event_data_, std::move(merged_event_data));
   merged_segments_ = segments_to_merge;
+  merged_partial_events_ = partial.second;
 
   return true;
 }
-
-void SegmentManager::loadSegmentsInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end) {
-  auto tryLoadSegment = [this](auto first, auto last) {
-    for (auto it = first; it != last; ++it) {
-      auto &segment_ptr = it->second;
-      if (!segment_ptr) {
-        segment_ptr = std::make_shared<Segment>(
-            it->first, route_.at(it->first), flags_, filters_,
-            [this](int seg_num, bool success) {
-              std::unique_lock lock(mutex_);
-              needs_update_ = true;
-              cv_.notify_one();
-            });
-      }
-
-      if (segment_ptr->getState() == Segment::LoadState::Loading) {
-        return true;  // Segment is still loading
-      }
-    }
-    return false;  // No segments need loading
-  };
-
-  // Try forward loading, then reverse if necessary
-  if (!tryLoadSegment(cur, end)) {
-    tryLoadSegment(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
-  }
-}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <map>
 #include <mutex>
@@ -9,15 +10,31 @@
 #include "tools/replay/route.h"
 
 constexpr int MIN_SEGMENTS_CACHE = 5;
+constexpr int DEFAULT_CONCURRENT_LOADS = 3;
 
 using SegmentMap = std::map<int, std::shared_ptr<Segment>>;
 
 class SegmentManager {
 public:
   struct EventData {
-    std::vector<Event> events;  //  Events extracted from the segments
+    std::vector<std::shared_ptr<const EventIndex>> indexes;  // Events of the segments, in segment order
     SegmentMap segments;        // Associated segments that contributed to these events
+    SegmentMap partial_segments;  // Segments still loading their log, with the events decoded so far
+    std::shared_ptr<const std::vector<Event>> partial_events;  // of the partial segment, when it was merged
     bool isSegmentLoaded(int n) const { return segments.find(n) != segments.end(); }
+    bool hasSegmentEvents(int n) const { return isSegmentLoaded(n) || partial_segments.find(n) != partial_segments.end(); }
+    const Segment *findSegment(int n) const {
+      auto it = segments.find(n);
+      if (it != segments.end()) return it->second.get();
+      it = partial_segments.find(n);
+      return it != partial_segments.end() ? it->second.get() : nullptr;
+    }
+    // Streams the events of all segments in time order, starting after (mono_time, which)
+    EventStream eventsAfter(uint64_t mono_time, cereal::Event::Which which) const {
+      std::vector<const EventIndex *> sources;
+      for (const auto &index : indexes) sources.push_back(index.get());
+      return EventStream(sources, mono_time, which);
+    }
   };
 
   SegmentManager(const std::string &route_name, uint32_t flags, const std::string &data_dir = "", bool auto_source = false)
@@ -26,17 +43,25 @@ public:
 
   bool load();
   void setCurrentSegment(int seg_num);
+  void setPlaybackSpeed(float speed);
   void setCallback(const std::function<void()> &callback) { onSegmentMergedCallback_ = callback; }
   void setFilters(const std::vector<bool> &filters) { filters_ = filters; }
   const std::shared_ptr<EventData> getEventData() const { return std::atomic_load(&event_data_); }
   bool hasSegment(int n) const { return segments_.find(n) != segments_.end(); }
+  // How long the segments loaded so far took to load
+  std::map<int, Segment::LoadStats> getLoadStats();
 
   Route route_;
   int segment_cache_limit_ = MIN_SEGMENTS_CACHE;
+  std::atomic<int> max_concurrent_loads_ = DEFAULT_CONCURRENT_LOADS;  // read by the cache thread
+
+  // Returns at most cache_limit segments to keep around cur_seg_num, in the order they are loaded
+  static std::vector<int> prefetchOrder(const SegmentMap &segments, int cur_seg_num, int direction, float playback_speed,
+                                        double avg_load_secs, int cache_limit);
 
 private:
   void manageSegmentCache();
-  void loadSegmentsInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end);
+  void loadSegments(const std::vector<int> &order);
   bool mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end);
 
   std::vector<bool> filters_;
@@ -46,11 +71,17 @@ private:
   std::condition_variable cv_;
   std::thread thread_;
   int cur_seg_num_ = -1;
+  int direction_ = 1;  // of the last move between segments
+  float playback_speed_ = 1.0;
+  double avg_load_secs_ = 0;
+  std::map<int, Segment::LoadStats> load_stats_;
   bool needs_update_ = false;
   bool exit_ = false;
 
   SegmentMap segments_;
+  std::vector<std::shared_ptr<Segment>> cancelled_;  // left the window while loading, waiting for their loads to stop
   std::shared_ptr<EventData> event_data_;
   std::function<void()> onSegmentMergedCallback_ = nullptr;
   std::set<int> merged_segments_;
+  std::shared_ptr<const std::vector<Event>> merged_partial_events_;
 };
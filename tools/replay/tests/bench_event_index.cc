@@ -0,0 +1,123 @@
+// Compares merging the events of the cached segments into one vector, as replay
+// used to on every change of the cache window, with streaming them from the
+// per-segment EventIndex. Reports the merge cost, the cost of a seek and of
+// iterating all events for an increasing number of segments.
+//
+// usage: bench_event_index [events per segment=78000]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "common/timing.h"
+#include "tools/replay/event_index.h"
+
+constexpr uint64_t SEGMENT_NANOS = 60e9;
+constexpr int SEEKS = 1000;
+
+// a sorted log of a segment. like real logs, it starts with INIT_DATA and overlaps
+// the previous segment a little
+static std::vector<Event> make_segment(int n, size_t count, std::mt19937_64 &rng) {
+  const cereal::Event::Which types[] = {cereal::Event::CAN, cereal::Event::CAR_STATE, cereal::Event::MODEL_V2,
+                                        cereal::Event::ROAD_ENCODE_IDX, cereal::Event::SENDCAN};
+  std::vector<Event> events;
+  events.reserve(count);
+  const uint64_t start = 1e9 + n * SEGMENT_NANOS;
+  events.emplace_back(cereal::Event::INIT_DATA, start, kj::ArrayPtr<const capnp::word>{});
+  for (size_t i = 1; i < count; ++i) {
+    uint64_t mono_time = start + i * (SEGMENT_NANOS / count) - rng() % 50000000;
+    events.emplace_back(types[rng() % std::size(types)], mono_time, kj::ArrayPtr<const capnp::word>{});
+  }
+  std::sort(events.begin(), events.end());
+  return events;
+}
+
+// SegmentManager::mergeSegments before the index
+static std::vector<Event> merge_segments(const std::vector<std::vector<Event>> &segments) {
+  size_t total = 0;
+  for (const auto &events : segments) total += events.size();
+
+  std::vector<Event> merged;
+  merged.reserve(total);
+  for (const auto &events : segments) {
+    auto first = events.front().which == cereal::Event::Which::INIT_DATA ? std::next(events.begin()) : events.begin();
+    size_t previous_size = merged.size();
+    merged.insert(merged.end(), first, events.end());
+    std::inplace_merge(merged.begin(), merged.begin() + previous_size, merged.end());
+  }
+  return merged;
+}
+
+int main(int argc, char **argv) {
+  const size_t events_per_segment = argc > 1 ? atol(argv[1]) : 78000;
+  std::mt19937_64 rng(42);
+
+  printf("%8s | %10s %10s %12s | %10s %10s %12s %14s\n", "segments", "merge ms", "seek us", "iterate ns",
+         "index ms", "seek us", "iterate ns", "index MB");
+  for (int num_segments : {1, 5, 10, 20, 40}) {
+    std::vector<std::vector<Event>> segments;
+    for (int n = 0; n < num_segments; ++n) segments.push_back(make_segment(n, events_per_segment, rng));
+    std::vector<uint64_t> seek_times(SEEKS);
+    for (auto &t : seek_times) t = 1e9 + rng() % (num_segments * SEGMENT_NANOS);
+
+    // merged vector
+    double start = millis_since_boot();
+    std::vector<Event> merged = merge_segments(segments);
+    const double merge_ms = millis_since_boot() - start;
+
+    start = millis_since_boot();
+    uint64_t checksum = 0;
+    for (uint64_t t : seek_times) {
+      auto it = std::upper_bound(merged.begin(), merged.end(), Event(cereal::Event::INIT_DATA, t, {}));
+      if (it != merged.end()) checksum += it->mono_time;
+    }
+    const double merged_seek_us = (millis_since_boot() - start) * 1000 / SEEKS;
+
+    start = millis_since_boot();
+    for (const Event &e : merged) checksum += e.mono_time;
+    const double merged_iterate_ns = (millis_since_boot() - start) * 1e6 / merged.size();
+
+    // per-segment indexes, built once when a segment is loaded
+    start = millis_since_boot();
+    std::vector<std::unique_ptr<EventIndex>> indexes;
+    for (const auto &events : segments) indexes.push_back(std::make_unique<EventIndex>(events));
+    const double index_ms = (millis_since_boot() - start) / num_segments;
+
+    std::vector<const EventIndex *> sources;
+    size_t index_bytes = 0;
+    for (const auto &index : indexes) {
+      sources.push_back(index.get());
+      index_bytes += index->size() * (sizeof(uint64_t) + sizeof(cereal::Event::Which));
+    }
+
+    start = millis_since_boot();
+    for (uint64_t t : seek_times) {
+      EventStream stream(sources, t, cereal::Event::INIT_DATA);
+      if (!stream.done()) checksum -= stream->mono_time;
+    }
+    const double stream_seek_us = (millis_since_boot() - start) * 1000 / SEEKS;
+
+    start = millis_since_boot();
+    size_t count = 0;
+    uint64_t prev_time = 0;
+    for (EventStream stream(sources, 0, cereal::Event::INIT_DATA); !stream.done(); ++stream, ++count) {
+      if (stream->mono_time < prev_time) {
+        fprintf(stderr, "stream is out of order\n");
+        return 1;
+      }
+      prev_time = stream->mono_time;
+      checksum -= stream->mono_time;
+    }
+    const double stream_iterate_ns = (millis_since_boot() - start) * 1e6 / count;
+
+    if (count != merged.size() || checksum != 0) {
+      fprintf(stderr, "stream differs from the merged events\n");
+      return 1;
+    }
+    printf("%8d | %10.2f %10.2f %12.2f | %10.2f %10.2f %12.2f %14.1f\n", num_segments, merge_ms, merged_seek_us,
+           merged_iterate_ns, index_ms, stream_seek_us, stream_iterate_ns, index_bytes / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Loads a log the way replay used to, reading and decompressing all of it before
+// parsing, and with the streaming LogReader. Reports the time until the first
+// events are available, the peak RSS and the anonymous memory still held by the
+// loaded log, which unlike mapped file pages can't be reclaimed by the kernel.
+// Each run is a separate process.
+//
+// usage: bench_logreader <rlog.zst|rlog.bz2|rlog> [repeat=3]
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/filereader.h"
+#include "tools/replay/logreader.h"
+
+struct Result {
+  double first_event_ms;
+  double loaded_ms;
+  size_t events;
+  double anon_rss_mb;
+};
+
+// 0 where /proc isn't available
+static double anon_rss_mb() {
+#ifdef __linux__
+  std::string status = util::read_file("/proc/self/status");
+  size_t pos = status.find("RssAnon:");
+  return pos != std::string::npos ? atof(status.c_str() + pos + 8) / 1024.0 : 0;
+#else
+  return 0;
+#endif
+}
+
+static double max_rss_mb(const struct rusage &usage) {
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+  return usage.ru_maxrss / 1024.0;  // KB
+#endif
+}
+
+static Result load_whole(const std::string &file) {
+  const double start = millis_since_boot();
+  std::string data = FileReader(false).read(file);
+  if (util::starts_with(data, "BZh9")) {
+    data = decompressBZ2(data);
+  } else if (util::starts_with(data, "\x28\xB5\x2F\xFD")) {
+    data = decompressZST(data);
+  }
+  LogReader log;
+  log.load(data.data(), data.size());
+  const double loaded = millis_since_boot() - start;
+  return {loaded, loaded, log.events.size(), anon_rss_mb()};
+}
+
+static Result load_streaming(const std::string &file) {
+  const double start = millis_since_boot();
+  double first_event = 0;
+  LogReader log;
+  log.on_progress = [&](const std::vector<Event> &events, size_t count) {
+    if (first_event == 0) first_event = millis_since_boot() - start;
+  };
+  log.load(file);
+  const double loaded = millis_since_boot() - start;
+  return {first_event > 0 ? first_event : loaded, loaded, log.events.size(), anon_rss_mb()};
+}
+
+static void run(const char *name, const std::function<Result()> &load) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    Result r = load();
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-10s %14.1f %10.1f %10zu %12.1f %12.1f\n", name, r.first_event_ms, r.loaded_ms, r.events,
+           max_rss_mb(usage), r.anon_rss_mb);
+    fflush(stdout);
+    _exit(0);
+  }
+  waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <rlog> [repeat=3]\n", argv[0]);
+    return 1;
+  }
+  const std::string file = argv[1];
+  const int repeat = argc > 2 ? atoi(argv[2]) : 3;
+
+  printf("%-10s %14s %10s %10s %12s %12s\n", "mode", "first event ms", "loaded ms", "events", "peak RSS MB", "anon RSS MB");
+  for (int i = 0; i < repeat; ++i) {
+    run("whole", [&]() { return load_whole(file); });
+    run("streaming", [&]() { return load_streaming(file); });
+  }
+  return 0;
+}
@@ -1,5 +1,12 @@
 #define CATCH_CONFIG_MAIN
+#include <bzlib.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <cstring>
+
 #include "catch2/catch.hpp"
+#include "common/util.h"
 #include "tools/replay/replay.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
@@ -15,3 +22,240 @@ TEST_CASE("LogReader") {
     REQUIRE(log.events.size() > 0);
   }
 }
+
+// a log of 60 s of 100 Hz can messages with payloads of up to 16 KB, logged a little out of order
+static std::string make_test_log() {
+  std::string log;
+  for (int i = 0; i < 6000; ++i) {
+    MessageBuilder msg;
+    auto event = msg.initEvent();
+    event.setLogMonoTime(1e9 + i * 1e7 - (i % 4) * 3e6);
+    auto can = event.initCan(1);
+    std::string dat((i * 7919) % (16 * 1024), 'a' + i % 26);
+    can[0].setDat(kj::arrayPtr((const uint8_t *)dat.data(), dat.size()));
+    auto bytes = msg.toBytes();
+    log.append((const char *)bytes.begin(), bytes.size());
+  }
+  return log;
+}
+
+// one zstd frame per frame_size bytes
+static std::string compress_zst(const std::string &data, size_t frame_size) {
+  std::string out;
+  for (size_t pos = 0; pos < data.size(); pos += frame_size) {
+    const size_t size = std::min(frame_size, data.size() - pos);
+    std::string frame(ZSTD_compressBound(size), '\0');
+    frame.resize(ZSTD_compress(frame.data(), frame.size(), data.data() + pos, size, 1));
+    out += frame;
+  }
+  return out;
+}
+
+static std::string compress_bz2(const std::string &data) {
+  std::string out(data.size() * 2, '\0');
+  unsigned int size = out.size();
+  REQUIRE(BZ2_bzBuffToBuffCompress(out.data(), &size, (char *)data.data(), data.size(), 1, 0, 0) == BZ_OK);
+  out.resize(size);
+  return out;
+}
+
+TEST_CASE("decompressZST") {
+  const std::string log = make_test_log();
+  const size_t frame_size = GENERATE(1024 * 1024, 100 * 1024 * 1024);
+  const std::string compressed = compress_zst(log, frame_size);
+  REQUIRE(findZSTFrames(compressed.data(), compressed.size()).size() == (log.size() + frame_size - 1) / frame_size);
+  REQUIRE(decompressZST(compressed) == log);
+
+  SECTION("truncated") {
+    std::string result = decompressZST(compressed.substr(0, compressed.size() / 2));
+    REQUIRE(result.size() > 0);
+    REQUIRE(result.size() < log.size());
+    REQUIRE(log.compare(0, result.size(), result) == 0);
+  }
+}
+
+TEST_CASE("LogReader streams compressed logs") {
+  const std::string log = make_test_log();
+  const std::string format = GENERATE("zst", "zst frames", "bz2");
+  const std::string compressed = format == "zst"        ? compress_zst(log, log.size())
+                                 : format == "zst frames" ? compress_zst(log, 1024 * 1024)
+                                                          : compress_bz2(log);
+  const std::string filename = "test_logreader_rlog." + format.substr(0, 3);
+  util::write_file(filename.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC);
+
+  auto filter = GENERATE(false, true);
+  std::vector<bool> filters;
+  if (filter) {
+    filters.resize(cereal::Event::Which::CAN + 1);
+    filters[cereal::Event::Which::CAN] = true;
+  }
+  LogReader reader(filters);
+  std::vector<size_t> progress;
+  reader.on_progress = [&](const std::vector<Event> &events, size_t count) {
+    REQUIRE(std::is_sorted(events.begin(), events.begin() + count));
+    progress.push_back(count);
+  };
+  REQUIRE(reader.load(filename));
+  ::unlink(filename.c_str());
+
+  REQUIRE(reader.events.size() == 6000);
+  REQUIRE(std::is_sorted(reader.events.begin(), reader.events.end()));
+  size_t total_size = 0;
+  for (const auto &e : reader.events) total_size += e.data.asBytes().size();
+  REQUIRE(total_size == log.size());
+
+  // the first events are available long before the log is done
+  REQUIRE(progress.size() > 1);
+  REQUIRE(std::is_sorted(progress.begin(), progress.end()));
+  REQUIRE(progress.front() < reader.events.size() / 10);
+}
+
+TEST_CASE("LogReader only decodes the selected frames of seekable logs") {
+  // 6 frames of 1000 events, the index claims only frame 2 has can messages
+  const std::string log = make_test_log();
+  std::vector<zstd_seek::FrameInfo> frames;
+  std::string compressed;
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  for (int i = 0; i < 6; ++i) {
+    const capnp::word *begin = words.begin();
+    for (int n = 0; n < 1000; ++n) {
+      capnp::FlatArrayMessageReader reader(words);
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+    const std::string frame((const char *)begin, (const char *)words.begin());
+    auto &f = frames.emplace_back();
+    f.decompressed_size = frame.size();
+    f.which[cereal::Event::Which::INIT_DATA] = true;
+    if (i == 2) f.which[cereal::Event::Which::CAN] = true;
+    const std::string compressed_frame = compress_zst(frame, frame.size());
+    f.compressed_size = compressed_frame.size();
+    compressed += compressed_frame;
+  }
+  compressed += zstd_seek::encode_index(frames);
+  const std::string filename = "test_logreader_seekable_rlog.zst";
+  util::write_file(filename.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC);
+
+  SECTION("one frame") {
+    std::vector<bool> filters(cereal::Event::Which::CAN + 1);
+    filters[cereal::Event::Which::CAN] = true;
+    LogReader reader(filters);
+    REQUIRE(reader.load(filename));
+    REQUIRE(reader.events.size() == 1000);
+    REQUIRE(reader.events.front().mono_time >= 1e9 + 2000 * 1e7 - 9e6);
+    REQUIRE(reader.events.back().mono_time < 1e9 + 3000 * 1e7);
+  }
+  SECTION("no frames") {
+    std::vector<bool> filters(cereal::Event::Which::CAR_STATE + 1);
+    filters[cereal::Event::Which::CAR_STATE] = true;
+    LogReader reader(filters);
+    REQUIRE_FALSE(reader.load(filename));
+    REQUIRE(reader.events.empty());
+  }
+  SECTION("all frames") {
+    LogReader reader;
+    REQUIRE(reader.load(filename));
+    REQUIRE(reader.events.size() == 6000);
+  }
+  ::unlink(filename.c_str());
+}
+
+TEST_CASE("MappedMemory") {
+  SECTION("file") {
+    const std::string filename = "test_mapped_memory";
+    const std::string content = make_test_log();
+    util::write_file(filename.c_str(), content.data(), content.size(), O_WRONLY | O_CREAT | O_TRUNC);
+    auto file = MappedMemory::mapFile(filename);
+    ::unlink(filename.c_str());
+    REQUIRE(file);
+    REQUIRE(std::string_view(file->data(), file->size()) == content);
+    // released pages are read again from the file
+    file->release(0, file->size());
+    REQUIRE(std::string_view(file->data(), file->size()) == content);
+    REQUIRE(MappedMemory::mapFile(filename) == nullptr);
+  }
+  SECTION("anonymous") {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    auto mem = MappedMemory::allocate(3 * 1024 * 1024 + 1);
+    REQUIRE(mem->size() == 3 * 1024 * 1024 + 1);
+    REQUIRE((uintptr_t)mem->data() % (2 * 1024 * 1024) == 0);
+    memset(mem->data(), 'x', mem->size());
+    // only the whole pages within the range are dropped
+    mem->release(1, 2 * page_size);
+    REQUIRE(mem->data()[page_size - 1] == 'x');
+#ifdef __linux__
+    // other systems may keep the content of released anonymous pages
+    REQUIRE(mem->data()[page_size] == 0);
+#endif
+    REQUIRE(mem->data()[2 * page_size] == 'x');
+  }
+}
+
+TEST_CASE("LogReader parses uncompressed logs in place") {
+  const std::string log = make_test_log();
+  const std::string filename = "test_logreader_rlog";
+  util::write_file(filename.c_str(), log.data(), log.size(), O_WRONLY | O_CREAT | O_TRUNC);
+
+  LogReader reader;
+  REQUIRE(reader.load(filename));
+  ::unlink(filename.c_str());
+  REQUIRE(reader.events.size() == 6000);
+  size_t total_size = 0;
+  for (const auto &e : reader.events) total_size += e.data.asBytes().size();
+  REQUIRE(total_size == log.size());
+}
+
+TEST_CASE("EventStream") {
+  // overlapping logs with duplicate timestamps
+  std::vector<std::vector<Event>> logs(3);
+  std::vector<Event> merged;
+  for (int i = 0; i < 3000; ++i) {
+    auto which = i % 2 ? cereal::Event::Which::CAN : cereal::Event::Which::CAR_STATE;
+    Event e(which, 1e9 + (i / 3) * 1e6 + (i % 3) * 5e5, {});
+    logs[i % 3].push_back(e);
+    merged.push_back(e);
+  }
+  std::vector<std::unique_ptr<EventIndex>> indexes;
+  std::vector<const EventIndex *> sources;
+  for (auto &log : logs) {
+    std::sort(log.begin(), log.end());
+    sources.push_back(indexes.emplace_back(std::make_unique<EventIndex>(log)).get());
+  }
+  std::sort(merged.begin(), merged.end());
+
+  for (const Event &from : {merged.front(), merged[1234], merged.back(), Event(cereal::Event::Which::INIT_DATA, 0, {})}) {
+    auto expected = std::upper_bound(merged.begin(), merged.end(), from);
+    for (EventStream stream(sources, from.mono_time, from.which); !stream.done(); ++stream, ++expected) {
+      REQUIRE(expected != merged.end());
+      REQUIRE(stream->mono_time == expected->mono_time);
+      REQUIRE(stream->which == expected->which);
+    }
+    REQUIRE(expected == merged.end());
+  }
+}
+
+TEST_CASE("SegmentManager::prefetchOrder") {
+  SegmentMap segments;
+  for (int n = 0; n < 10; ++n) segments[n] = nullptr;
+  auto order = [&](int cur, int direction, float speed, double load_secs, int limit = 5) {
+    return SegmentManager::prefetchOrder(segments, cur, direction, speed, load_secs, limit);
+  };
+
+  SECTION("direction") {
+    REQUIRE(order(5, 1, 1, 0) == std::vector<int>{5, 6, 7, 4, 3});
+    REQUIRE(order(5, -1, 1, 0) == std::vector<int>{5, 4, 3, 6, 7});
+  }
+  SECTION("speed") {
+    // a load takes two segments of playback, so three are kept ahead
+    REQUIRE(order(5, 1, 4, 30) == std::vector<int>{5, 6, 7, 8, 4});
+    REQUIRE(order(5, -1, 4, 30) == std::vector<int>{5, 4, 3, 2, 6});
+    // all but cur are ahead at most
+    REQUIRE(order(5, 1, 20, 30) == std::vector<int>{5, 6, 7, 8, 9});
+  }
+  SECTION("budget") {
+    REQUIRE(order(5, 1, 1, 0, 3) == std::vector<int>{5, 6, 4});
+    REQUIRE(order(5, 1, 1, 0, 20).size() == segments.size());
+    // segments missing ahead are made up for behind
+    REQUIRE(order(8, 1, 1, 0) == std::vector<int>{8, 9, 7, 6, 5});
+    REQUIRE(order(0, -1, 1, 0) == std::vector<int>{0, 1, 2, 3, 4});
+  }
+}
@@ -2,18 +2,24 @@
 
 #include <bzlib.h>
 #include <curl/curl.h>
+#include <fcntl.h>
 #include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <algorithm>
 #include <cmath>
 #include <cstdarg>
+#include <condition_variable>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <numeric>
+#include <thread>
 #include <utility>
 #include <zstd.h>
 
@@ -278,6 +284,144 @@ bool httpDownload(const std::string &url, const std::string &file, size_t chunk_
   return httpDownload(url, of, chunk_size, size, abort);
 }
 
+namespace {
+
+// ZSTD_DCtx are expensive to create, keep them for the next file
+class DCtxPool {
+public:
+  ~DCtxPool() {
+    for (auto dctx : free_) ZSTD_freeDCtx(dctx);
+  }
+  ZSTD_DCtx *get() {
+    {
+      std::lock_guard lk(lock_);
+      if (!free_.empty()) {
+        ZSTD_DCtx *dctx = free_.back();
+        free_.pop_back();
+        return dctx;
+      }
+    }
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    assert(dctx != nullptr);
+    return dctx;
+  }
+  void put(ZSTD_DCtx *dctx) {
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    std::lock_guard lk(lock_);
+    free_.push_back(dctx);
+  }
+
+private:
+  std::mutex lock_;
+  std::vector<ZSTD_DCtx *> free_;
+};
+
+static DCtxPool dctx_pool;
+
+struct PooledDCtx {
+  PooledDCtx() : dctx(dctx_pool.get()) {}
+  ~PooledDCtx() { dctx_pool.put(dctx); }
+  operator ZSTD_DCtx *() const { return dctx; }
+  ZSTD_DCtx *dctx;
+};
+
+// Threads shared by all concurrent decompressions
+class WorkerPool {
+public:
+  WorkerPool() {
+    const int count = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    for (int i = 0; i < count; ++i) {
+      threads_.emplace_back([this]() { worker(); });
+    }
+  }
+  ~WorkerPool() {
+    {
+      std::lock_guard lk(lock_);
+      exit_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) t.join();
+  }
+  size_t size() const { return threads_.size(); }
+  void run(std::function<void()> task) {
+    {
+      std::lock_guard lk(lock_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+private:
+  void worker() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lk(lock_);
+        cv_.wait(lk, [this]() { return exit_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> threads_;
+  bool exit_ = false;
+};
+
+WorkerPool &worker_pool() {
+  static WorkerPool pool;
+  return pool;
+}
+
+// A decompressZSTFrames() call, shared with the workers that help out. Frames are
+// handed out in order, so the decompressed prefix grows steadily.
+struct FramesJob {
+  std::vector<zstd_seek::FrameInfo> frames;
+  std::vector<size_t> out_offsets;
+  const char *in = nullptr;
+  size_t in_size = 0;
+  char *out = nullptr;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  size_t next = 0;
+  size_t running = 0;
+  std::vector<int> done;  // 1 decompressed, -1 corrupt
+
+  // Returns false when there are no frames left
+  bool decompressNext() {
+    size_t i;
+    {
+      std::lock_guard lk(lock);
+      if (next >= frames.size()) return false;
+      i = next++;
+      ++running;
+    }
+
+    const auto &f = frames[i];
+    bool success = false;
+    if (f.offset + f.compressed_size <= in_size) {
+      PooledDCtx dctx;
+      size_t result = ZSTD_decompressDCtx(dctx, out + out_offsets[i], f.decompressed_size, in + f.offset, f.compressed_size);
+      success = !ZSTD_isError(result) && result == f.decompressed_size;
+    }
+    {
+      std::lock_guard lk(lock);
+      done[i] = success ? 1 : -1;
+      --running;
+    }
+    cv.notify_all();
+    return true;
+  }
+};
+
+} // namespace
+
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort) {
   return decompressBZ2((std::byte *)in.data(), in.size(), abort);
 }
@@ -324,44 +468,204 @@ std::string decompressZST(const std::string &in, std::atomic<bool> *abort) {
 }
 
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort) {
-  ZSTD_DCtx *dctx = ZSTD_createDCtx();
-  assert(dctx != nullptr);
-
-  // Initialize input and output buffers
-  ZSTD_inBuffer input = {in, in_size, 0};
-
-  // Estimate and reserve memory for decompressed data
-  size_t estimatedDecompressedSize = ZSTD_getFrameContentSize(in, in_size);
-  if (estimatedDecompressedSize == ZSTD_CONTENTSIZE_ERROR || estimatedDecompressedSize == ZSTD_CONTENTSIZE_UNKNOWN) {
-    estimatedDecompressedSize = in_size * 2;  // Use a fallback size
+  // with known frame sizes, decompress the frames concurrently into an exact-size output
+  auto frames = zstd_seek::decode_index((const char *)in, in_size);
+  if (frames.empty()) {
+    frames = findZSTFrames((const char *)in, in_size);
+  }
+  if (!frames.empty()) {
+    size_t total_size = 0;
+    for (const auto &f : frames) total_size += f.decompressed_size;
+    std::string decompressedData(total_size, '\0');
+    decompressedData.resize(decompressZSTFrames((const char *)in, in_size, frames, decompressedData.data(), nullptr, abort));
+    return !(abort && *abort) ? decompressedData : "";
   }
 
-  std::string decompressedData;
-  decompressedData.reserve(estimatedDecompressedSize);
-
-  const size_t bufferSize = ZSTD_DStreamOutSize();  // Recommended output buffer size
-  std::string outputBuffer(bufferSize, '\0');
-
+  // the size is unknown, decompress straight into a growing output
+  PooledDCtx dctx;
+  ZSTD_inBuffer input = {in, in_size, 0};
+  std::string decompressedData(std::max(in_size * 4, ZSTD_DStreamOutSize()), '\0');
+  size_t pos = 0;
   while (input.pos < input.size && !(abort && *abort)) {
-    ZSTD_outBuffer output = {outputBuffer.data(), bufferSize, 0};
-
+    if (pos == decompressedData.size()) {
+      decompressedData.resize(decompressedData.size() * 2);
+    }
+    ZSTD_outBuffer output = {decompressedData.data() + pos, decompressedData.size() - pos, 0};
     size_t result = ZSTD_decompressStream(dctx, &output, &input);
     if (ZSTD_isError(result)) {
       rWarning("decompressZST error: content is corrupt");
       break;
     }
-
-    decompressedData.append(outputBuffer.data(), output.pos);
+    pos += output.pos;
   }
 
-  ZSTD_freeDCtx(dctx);
   if (!(abort && *abort)) {
+    decompressedData.resize(pos);
     decompressedData.shrink_to_fit();
     return decompressedData;
   }
   return {};
 }
 
+std::string decompressZSTFrames(const std::string &in, const std::vector<zstd_seek::FrameInfo> &frames, std::atomic<bool> *abort) {
+  size_t total_size = 0;
+  for (const auto &f : frames) total_size += f.decompressed_size;
+
+  std::string decompressedData(total_size, '\0');
+  decompressedData.resize(decompressZSTFrames(in.data(), in.size(), frames, decompressedData.data(), nullptr, abort));
+  return !(abort && *abort) ? decompressedData : "";
+}
+
+std::vector<zstd_seek::FrameInfo> findZSTFrames(const char *in, size_t in_size) {
+  std::vector<zstd_seek::FrameInfo> frames;
+  uint64_t decompressed_offset = 0;
+  for (size_t pos = 0; pos < in_size;) {
+    const size_t frame_size = ZSTD_findFrameCompressedSize(in + pos, in_size - pos);
+    const unsigned long long content_size = ZSTD_getFrameContentSize(in + pos, in_size - pos);
+    if (ZSTD_isError(frame_size) || content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR) {
+      return {};
+    }
+    // skippable frames have no content
+    if (content_size > 0) {
+      auto &f = frames.emplace_back();
+      f.offset = pos;
+      f.decompressed_offset = decompressed_offset;
+      f.compressed_size = frame_size;
+      f.decompressed_size = content_size;
+      decompressed_offset += content_size;
+    }
+    pos += frame_size;
+  }
+  return frames;
+}
+
+size_t decompressZSTFrames(const char *in, size_t in_size, const std::vector<zstd_seek::FrameInfo> &frames, char *out,
+                           const std::function<bool(size_t)> &on_ready, std::atomic<bool> *abort) {
+  if (frames.empty()) return 0;
+
+  auto job = std::make_shared<FramesJob>();
+  job->frames = frames;
+  job->in = in;
+  job->in_size = in_size;
+  job->out = out;
+  job->out_offsets.resize(frames.size());
+  for (size_t i = 1; i < frames.size(); ++i) {
+    job->out_offsets[i] = job->out_offsets[i - 1] + frames[i - 1].decompressed_size;
+  }
+  job->done.resize(frames.size());
+
+  const size_t helpers = std::min(worker_pool().size(), frames.size() - 1);
+  for (size_t i = 0; i < helpers; ++i) {
+    worker_pool().run([job]() { while (job->decompressNext()) {} });
+  }
+
+  // the caller decompresses frames as well, and reports the decompressed prefix in between
+  size_t ready = 0, ready_size = 0;
+  bool stop = false;
+  while (ready < frames.size()) {
+    const bool claimed = !stop && job->decompressNext();
+
+    std::unique_lock lk(job->lock);
+    if (stop) {
+      // the frames still being decompressed write to out
+      job->cv.wait(lk, [&]() { return job->running == 0; });
+      break;
+    }
+    if (!claimed) {
+      job->cv.wait(lk, [&]() { return job->done[ready] != 0; });
+    }
+
+    const size_t prev_ready_size = ready_size;
+    while (ready < frames.size() && job->done[ready] == 1) {
+      ready_size += frames[ready++].decompressed_size;
+    }
+    if (ready < frames.size() && job->done[ready] == -1) {
+      rWarning("decompressZSTFrames error: content is corrupt");
+      stop = true;
+    }
+    stop = stop || (abort && *abort);
+    if (stop) {
+      job->next = frames.size();
+      continue;
+    }
+    lk.unlock();
+
+    if (on_ready && ready_size > prev_ready_size && !on_ready(ready_size)) {
+      stop = true;
+      std::lock_guard guard(job->lock);
+      job->next = frames.size();
+    }
+  }
+  return ready_size;
+}
+
+namespace {
+
+class BZ2StreamDecompressor : public StreamDecompressor {
+public:
+  BZ2StreamDecompressor() {
+    int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
+    assert(bzerror == BZ_OK);
+  }
+  ~BZ2StreamDecompressor() { BZ2_bzDecompressEnd(&strm); }
+
+  ssize_t decompress(std::string_view &in, char *out, size_t out_size) override {
+    if (stream_end) return 0;
+
+    strm.next_in = (char *)in.data();
+    strm.avail_in = in.size();
+    strm.next_out = out;
+    strm.avail_out = out_size;
+    while (strm.avail_out > 0) {
+      const unsigned int prev_avail_in = strm.avail_in, prev_avail_out = strm.avail_out;
+      int bzerror = BZ2_bzDecompress(&strm);
+      if (bzerror == BZ_STREAM_END) {
+        stream_end = true;
+        break;
+      } else if (bzerror != BZ_OK) {
+        rWarning("decompressBZ2 error: content is corrupt");
+        return -1;
+      } else if (strm.avail_in == prev_avail_in && strm.avail_out == prev_avail_out) {
+        break;  // the input is used up
+      }
+    }
+    in.remove_prefix(in.size() - strm.avail_in);
+    return out_size - strm.avail_out;
+  }
+
+private:
+  bz_stream strm = {};
+  bool stream_end = false;
+};
+
+class ZSTStreamDecompressor : public StreamDecompressor {
+public:
+  ssize_t decompress(std::string_view &in, char *out, size_t out_size) override {
+    ZSTD_inBuffer input = {in.data(), in.size(), 0};
+    ZSTD_outBuffer output = {out, out_size, 0};
+    while (output.pos < output.size) {
+      const size_t prev_in_pos = input.pos, prev_out_pos = output.pos;
+      size_t result = ZSTD_decompressStream(dctx, &output, &input);
+      if (ZSTD_isError(result)) {
+        rWarning("decompressZST error: content is corrupt");
+        return -1;
+      } else if (input.pos == prev_in_pos && output.pos == prev_out_pos) {
+        break;  // the input is used up
+      }
+    }
+    in.remove_prefix(input.pos);
+    return output.pos;
+  }
+
+private:
+  PooledDCtx dctx;
+};
+
+} // namespace
+
+std::unique_ptr<StreamDecompressor> StreamDecompressor::createBZ2() { return std::make_unique<BZ2StreamDecompressor>(); }
+std::unique_ptr<StreamDecompressor> StreamDecompressor::createZST() { return std::make_unique<ZSTStreamDecompressor>(); }
+
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested) {
   struct timespec req, rem;
   req.tv_sec = nanoseconds / 1000000000;
@@ -432,3 +736,53 @@ MonotonicBuffer::~MonotonicBuffer() {
     free(buf);
   }
 }
+
+// MappedMemory
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+std::unique_ptr<MappedMemory> MappedMemory::mapFile(const std::string &file) {
+  int fd = HANDLE_EINTR(open(file.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd == -1) return nullptr;
+
+  struct stat st = {};
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return nullptr;
+
+  // logs are read front to back, start reading ahead
+  madvise(map, st.st_size, MADV_WILLNEED);
+  return std::unique_ptr<MappedMemory>(new MappedMemory(map, st.st_size, (char *)map, st.st_size));
+}
+
+std::unique_ptr<MappedMemory> MappedMemory::allocate(size_t size) {
+  // map a huge page more than needed and trim it to a huge page aligned range
+  const size_t aligned_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void *map = mmap(nullptr, aligned_size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) throw std::bad_alloc();
+
+  char *begin = (char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  char *end = begin + aligned_size;
+  if (begin != map) munmap(map, begin - (char *)map);
+  if (end != (char *)map + aligned_size + HUGE_PAGE_SIZE) munmap(end, (char *)map + aligned_size + HUGE_PAGE_SIZE - end);
+#ifdef MADV_HUGEPAGE
+  madvise(begin, aligned_size, MADV_HUGEPAGE);
+#endif
+  return std::unique_ptr<MappedMemory>(new MappedMemory(begin, aligned_size, begin, size));
+}
+
+MappedMemory::~MappedMemory() {
+  munmap(map_, map_size_);
+}
+
+void MappedMemory::release(size_t offset, size_t length) {
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = ((uintptr_t)data_ + offset + page_size - 1) & ~(page_size - 1);
+  const uintptr_t end = ((uintptr_t)data_ + std::min(offset + length, size_)) & ~(page_size - 1);
+  if (begin < end) {
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+  }
+}
@@ -3,11 +3,14 @@
 #include <atomic>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
+#include <sys/types.h>
 #include "cereal/messaging/messaging.h"
+#include "system/loggerd/zstd_seek_index.h"
 
 enum CameraType {
   RoadCam = 0,
@@ -46,12 +49,56 @@ private:
   static constexpr float growth_factor = 1.5;
 };
 
+// A file mapped read-only, or anonymous memory for large buffers. Anonymous memory is aligned
+// for transparent huge pages. Pages that are no longer needed can be returned with release().
+class MappedMemory {
+public:
+  // Returns nullptr if the file can't be mapped.
+  static std::unique_ptr<MappedMemory> mapFile(const std::string &file);
+  static std::unique_ptr<MappedMemory> allocate(size_t size);
+  ~MappedMemory();
+  char *data() const { return data_; }
+  size_t size() const { return size_; }
+  // Drops the whole pages within [offset, offset + length). Anonymous pages read back as zeros,
+  // file pages are read again from the file.
+  void release(size_t offset, size_t length);
+
+private:
+  MappedMemory(void *map, size_t map_size, char *data, size_t size)
+      : map_(map), map_size_(map_size), data_(data), size_(size) {}
+  void *map_;
+  size_t map_size_;
+  char *data_;
+  size_t size_;
+};
+
 std::string sha256(const std::string &str);
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &interrupt_requested);
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
+// decompresses only the given frames of a seekable zstd log, see zstd_seek::decode_index
+std::string decompressZSTFrames(const std::string &in, const std::vector<zstd_seek::FrameInfo> &frames, std::atomic<bool> *abort = nullptr);
+// Decompresses the frames concurrently and packs them back to back into out, which must hold the sum of their
+// decompressed sizes. on_ready is called on the calling thread whenever the decompressed prefix of out grows,
+// and stops the decompression by returning false. Returns the size of the decompressed prefix.
+size_t decompressZSTFrames(const char *in, size_t in_size, const std::vector<zstd_seek::FrameInfo> &frames, char *out,
+                           const std::function<bool(size_t)> &on_ready = nullptr, std::atomic<bool> *abort = nullptr);
+// Locates the frames of a zstd file from their headers. Returns no frames if any of them doesn't store its decompressed size.
+std::vector<zstd_seek::FrameInfo> findZSTFrames(const char *in, size_t in_size);
+
+// Decompresses bz2 or zstd data incrementally, so the output can be processed while the rest is decoded.
+class StreamDecompressor {
+public:
+  static std::unique_ptr<StreamDecompressor> createBZ2();
+  static std::unique_ptr<StreamDecompressor> createZST();
+  virtual ~StreamDecompressor() {}
+  // Decompresses from the front of in into out and advances in past the consumed input.
+  // Returns the number of bytes written, 0 at the end of the input, or -1 if it is corrupt.
+  virtual ssize_t decompress(std::string_view &in, char *out, size_t out_size) = 0;
+};
+
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);